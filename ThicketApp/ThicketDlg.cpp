@@ -384,7 +384,7 @@ LRESULT CThicketDlg::OnRunProgress(WPARAM w, LPARAM l)
 		m_transformsList.SetItemCount((int)pTree->transforms.size());
 
 		CString str;
-		str.Format(L"Q:%zu", pTree->nodeQueue.size());
+		str.Format(L"Q:%zu", pTree->getQueueSize());
 		//if (m_demo.m_randomize) str += " randomize";
 		//if (m_demo.m_restart) str += " restart";
 		if (m_demo.isStepping()) str += " step";
@@ -466,7 +466,7 @@ void CThicketDlg::OnLvnGetdispinfoTransforms(NMHDR *pNMHDR, LRESULT *pResult)
 				break;
 
 			case 1:
-				::wnsprintf(pItem->pszText, pItem->cchTextMax, L"%d", pTree->transformCounts[t.transformMatrixKey]);
+				::wnsprintf(pItem->pszText, pItem->cchTextMax, L"%d", pTree->getTransformCount(t));
 				break;
 
 			case 2: // gestation
@@ -666,7 +666,7 @@ void CThicketDlg::OnLvnColumnclickTransforms(NMHDR *pNMHDR, LRESULT *pResult)
 
 		case 1: // freq
 			std::sort(m_sortOrder.begin(), m_sortOrder.end(),
-				[&](size_t i1, size_t i2) { return pTree->transformCounts[t[i1].transformMatrixKey] < pTree->transformCounts[t[i2].transformMatrixKey]; });
+				[&](size_t i1, size_t i2) { return pTree->getTransformCount(t[i1]) < pTree->getTransformCount(t[i2]); });
 			break;
 
 		case 2: // gestation
@@ -6,7 +6,13 @@
 #include <boost/test/included/unit_test.hpp>
 #include "../tree/tree.h"
 #include "../tree/SelfLimitingPolygonTree.h"
+#include "../tree/qbitfield.h"
+#include "../tree/qscanline.h"
+#include "../tree/qstampcache.h"
+#include "../tree/growthrun.h"
 #include <string>
+#include <random>
+#include <set>
 
 BOOST_AUTO_TEST_CASE(my_boost_test)
 {
@@ -21,3 +27,662 @@ BOOST_AUTO_TEST_CASE(my_boost_test)
 
     BOOST_CHECK(pTree->transforms.size() == 5);
 }
+
+
+namespace
+{
+    //  true if {a} and {b} have the same size and the same cells set
+    bool sameCells(cv::Mat1b const &a, cv::Mat1b const &b)
+    {
+        if (a.rows != b.rows || a.cols != b.cols)
+            return false;
+        for (int y = 0; y < a.rows; ++y)
+            for (int x = 0; x < a.cols; ++x)
+                if (!a(y, x) != !b(y, x))
+                    return false;
+        return true;
+    }
+
+    //  Random 8-bit mask of a random rect within {size}: sparse, half full or solid
+    cv::Rect makeRandomMask(std::mt19937 &prng, cv::Size size, cv::Mat1b &mask)
+    {
+        int x = prng() % size.width, y = prng() % size.height;
+        int width = 1 + prng() % std::min(200, size.width - x);
+        int height = 1 + prng() % std::min(200, size.height - y);
+        int density = prng() % 3;
+
+        mask = cv::Mat1b::zeros(height, width);
+        for (int j = 0; j < height; ++j)
+            for (int i = 0; i < width; ++i)
+                mask(j, i) = ((density == 2 || prng() % (density ? 2 : 16) == 0) ? 255 : 0);
+
+        return cv::Rect(x, y, width, height);
+    }
+}
+
+
+BOOST_AUTO_TEST_SUITE(qbitfield_tests)
+
+BOOST_AUTO_TEST_CASE(overlap_matches_reference)
+{
+    // sizes that aren't whole tiles or superblocks
+    for (cv::Size size : { cv::Size(700, 300), cv::Size(70, 650), cv::Size(64, 64) })
+    {
+        std::mt19937 prng(size.width * size.height);
+        cv::Mat1b reference = cv::Mat1b::zeros(size.height, size.width);
+        qbitfield field;
+        field.create(size);
+
+        for (int i = 0; i < 500; ++i)
+        {
+            cv::Mat1b image;
+            cv::Rect rect = makeRandomMask(prng, size, image);
+            qbitmask mask;
+            mask.pack(rect, image);
+
+            long long expected = 0;
+            for (int y = 0; y < rect.height; ++y)
+                for (int x = 0; x < rect.width; ++x)
+                    expected += (image(y, x) && reference(rect.y + y, rect.x + x));
+
+            BOOST_CHECK_EQUAL(field.countOverlap(mask), expected);
+            BOOST_CHECK_EQUAL(field.intersects(mask), expected > 0);
+
+            // mostly composite, so tiles fill up, with some erases
+            bool erase = (prng() % 4 == 0);
+            for (int y = 0; y < rect.height; ++y)
+                for (int x = 0; x < rect.width; ++x)
+                    if (image(y, x))
+                        reference(rect.y + y, rect.x + x) = (erase ? 0 : 255);
+            if (erase)
+                field.erase(mask);
+            else
+                field.composite(mask);
+        }
+
+        cv::Mat1b image;
+        field.toMat(image);
+        BOOST_CHECK(sameCells(image, reference));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(tile_released_with_last_cell)
+{
+    qbitfield field;
+    field.create(cv::Size(256, 256));
+    size_t emptySize = field.getMemorySize();
+
+    // two cells either side of a tile corner
+    cv::Mat1b image = cv::Mat1b::zeros(2, 2);
+    image(0, 0) = image(1, 1) = 255;
+    qbitmask corner;
+    corner.pack(cv::Rect(63, 127, 2, 2), image);
+    field.composite(corner);
+    BOOST_CHECK_EQUAL(field.getTileCount(), 2u);
+    BOOST_CHECK(field.getBlockOccupancy(0, 1) == qbitfield::Occupancy::MIXED);
+    BOOST_CHECK(field.getBlockOccupancy(1, 2) == qbitfield::Occupancy::MIXED);
+    BOOST_CHECK(field.getBlockOccupancy(1, 1) == qbitfield::Occupancy::EMPTY);
+
+    // erasing cells that aren't set changes nothing
+    qbitmask other;
+    other.create(cv::Rect(64, 127, 1, 1));
+    other.setSpan(0, 0, 0);
+    uint64_t version = field.getVersion(cv::Rect(0, 0, 256, 256));
+    field.erase(other);
+    BOOST_CHECK_EQUAL(field.getTileCount(), 2u);
+    BOOST_CHECK_EQUAL(field.getVersion(cv::Rect(0, 0, 256, 256)), version);
+
+    qbitmask first;
+    first.create(cv::Rect(63, 127, 1, 1));
+    first.setSpan(0, 0, 0);
+    field.erase(first);
+    BOOST_CHECK_EQUAL(field.getTileCount(), 1u);
+    BOOST_CHECK(field.getBlockOccupancy(0, 1) == qbitfield::Occupancy::EMPTY);
+    BOOST_CHECK(field.get(64, 128));
+
+    field.erase(corner);
+    BOOST_CHECK_EQUAL(field.getTileCount(), 0u);
+    BOOST_CHECK_EQUAL(field.getMemorySize(), emptySize);
+    BOOST_CHECK(!field.intersects(corner));
+    BOOST_CHECK_NE(field.getVersion(cv::Rect(0, 0, 256, 256)), version);
+}
+
+BOOST_AUTO_TEST_CASE(occupancy_at_superblock_edges)
+{
+    // superblocks are 512x512 cells: the field has one whole column of superblocks, a clipped one
+    // 88 cells wide, and a clipped row 200 cells high. Its right edge tiles are 24 cells wide, its
+    // bottom ones 8 high.
+    cv::Size size(600, 200);
+    qbitfield field;
+    field.create(size);
+
+    for (int by = 0; by < 4; ++by)
+        for (int bx = 0; bx < 10; ++bx)
+            BOOST_CHECK(field.getBlockOccupancy(bx, by) == qbitfield::Occupancy::EMPTY);
+
+    qbitmask all;
+    all.create(cv::Rect(cv::Point(), size));
+    for (int y = 0; y < size.height; ++y)
+        all.setSpan(y, 0, size.width - 1);
+    field.composite(all);
+
+    // clipped tiles and superblocks count as full when every cell inside the field is set
+    for (int by = 0; by < 4; ++by)
+        for (int bx = 0; bx < 10; ++bx)
+            BOOST_CHECK(field.getBlockOccupancy(bx, by) == qbitfield::Occupancy::FULL);
+    BOOST_CHECK_EQUAL(field.countOverlap(all), (long long)size.area());
+
+    // one cell off the corner tile: the tile is mixed, its neighbors in the superblock still full
+    qbitmask corner;
+    corner.create(cv::Rect(599, 199, 1, 1));
+    corner.setSpan(0, 0, 0);
+    field.erase(corner);
+    BOOST_CHECK(field.getBlockOccupancy(9, 3) == qbitfield::Occupancy::MIXED);
+    BOOST_CHECK(field.getBlockOccupancy(8, 3) == qbitfield::Occupancy::FULL);
+    BOOST_CHECK(field.getBlockOccupancy(9, 2) == qbitfield::Occupancy::FULL);
+    BOOST_CHECK(field.getBlockOccupancy(7, 3) == qbitfield::Occupancy::FULL);
+    BOOST_CHECK(!field.intersects(corner));
+    BOOST_CHECK_EQUAL(field.countOverlap(all), (long long)size.area() - 1);
+
+    // the whole corner tile
+    qbitmask tile;
+    tile.create(cv::Rect(576, 192, 24, 8));
+    for (int y = 0; y < 8; ++y)
+        tile.setSpan(y, 0, 23);
+    field.erase(tile);
+    BOOST_CHECK(field.getBlockOccupancy(9, 3) == qbitfield::Occupancy::EMPTY);
+    BOOST_CHECK(field.getBlockOccupancy(8, 3) == qbitfield::Occupancy::FULL);
+    BOOST_CHECK_EQUAL(field.countOverlap(all), (long long)size.area() - 8 * 24);
+
+    field.composite(corner);
+    BOOST_CHECK(field.getBlockOccupancy(9, 3) == qbitfield::Occupancy::MIXED);
+    BOOST_CHECK(field.intersects(corner));
+    BOOST_CHECK(!field.intersectsRow(tile, 0));
+    BOOST_CHECK(field.intersectsRow(tile, 7));
+}
+
+BOOST_AUTO_TEST_CASE(mat_round_trip)
+{
+    cv::Size size(300, 130);
+    std::mt19937 prng(1);
+    cv::Mat1b image = cv::Mat1b::zeros(size.height, size.width);
+    for (int i = 0; i < 20; ++i)
+    {
+        cv::Mat1b mask;
+        cv::Rect rect = makeRandomMask(prng, size, mask);
+        for (int y = 0; y < rect.height; ++y)
+            for (int x = 0; x < rect.width; ++x)
+                if (mask(y, x))
+                    image(rect.y + y, rect.x + x) = 255;
+    }
+
+    qbitfield field;
+    field.create(size);
+    field.fromMat(image);
+
+    cv::Mat1b result;
+    field.toMat(result);
+    BOOST_CHECK(sameCells(result, image));
+
+    // fromMat replaces the field, so an empty image releases every tile
+    cv::Mat1b empty = cv::Mat1b::zeros(size.height, size.width);
+    field.fromMat(empty);
+    BOOST_CHECK_EQUAL(field.getTileCount(), 0u);
+    field.toMat(result);
+    BOOST_CHECK(sameCells(result, empty));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+namespace
+{
+    //  Integer polygons in field coordinates: convex, concave and thin, with spans crossing word
+    //  boundaries and edges of every slope
+    std::vector<std::vector<cv::Point> > getTestPolygons()
+    {
+        return {
+            // convex hexagon
+            { { 10, 5 }, { 40, 2 }, { 63, 20 }, { 58, 47 }, { 25, 50 }, { 3, 30 } },
+            // axis-aligned square
+            { { 70, 10 }, { 130, 10 }, { 130, 70 }, { 70, 70 } },
+            // sliver triangle
+            { { 0, 0 }, { 120, 7 }, { 5, 3 } },
+            // five-pointed star
+            { { 100, 20 }, { 109, 48 }, { 138, 48 }, { 114, 65 }, { 124, 92 }, { 100, 75 }, { 76, 92 }, { 86, 65 }, { 62, 48 }, { 91, 48 } },
+            // small seven-pointed star
+            { { 29, 22 }, { 23, 22 }, { 24, 28 }, { 20, 24 }, { 17, 28 }, { 17, 23 }, { 11, 22 }, { 16, 19 }, { 13, 15 }, { 18, 16 }, { 20, 11 }, { 22, 16 }, { 27, 14 }, { 24, 19 } },
+            // ThornTree polygons, as field points of a large and a small node
+            { { 100, 80 }, { 129, 91 }, { 105, 111 }, { 88, 136 }, { 77, 165 }, { 74, 196 }, { 69, 165 }, { 72, 135 }, { 82, 105 } },
+            { { 70, 20 }, { 74, 17 }, { 75, 22 }, { 76, 27 }, { 79, 31 }, { 83, 34 }, { 78, 32 }, { 75, 29 }, { 72, 25 } }
+        };
+    }
+
+    std::vector<cv::Point> translate(std::vector<cv::Point> const &pts, cv::Point offset)
+    {
+        std::vector<cv::Point> result;
+        for (auto const &pt : pts)
+            result.push_back(pt + offset);
+        return result;
+    }
+
+    //  The cells the collision mask should have: the polygon filled, less its outline
+    void drawReference(std::vector<cv::Point> const &pts, cv::Rect const &rect, cv::Mat1b &image)
+    {
+        std::vector<std::vector<cv::Point> > polygons(1, translate(pts, -rect.tl()));
+        image = cv::Mat1b::zeros(rect.height, rect.width);
+        cv::fillPoly(image, polygons, cv::Scalar(255), cv::LINE_8);
+        cv::polylines(image, polygons, true, cv::Scalar(0), 1, cv::LINE_8);
+    }
+}
+
+
+BOOST_AUTO_TEST_SUITE(qscanline_tests)
+
+BOOST_AUTO_TEST_CASE(rasterize_matches_fillPoly)
+{
+    // offsets move the polygons across word boundaries
+    for (auto const &polygon : getTestPolygons())
+    {
+        for (cv::Point offset : { cv::Point(0, 0), cv::Point(37, 3), cv::Point(190, 101) })
+        {
+            std::vector<cv::Point> pts = translate(polygon, offset);
+            cv::Rect rect = cv::boundingRect(pts);
+
+            qbitmask mask;
+            BOOST_CHECK(!qscanline::rasterize(pts, rect, mask));
+            BOOST_CHECK(mask.rect == rect);
+
+            cv::Mat1b result, expected;
+            mask.toMat(result);
+            drawReference(pts, rect, expected);
+            BOOST_CHECK(sameCells(result, expected));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rasterize_stops_at_first_overlap)
+{
+    std::vector<cv::Point> pts = translate(getTestPolygons()[3], cv::Point(37, 3));
+    cv::Rect rect = cv::boundingRect(pts);
+
+    qbitmask full;
+    qscanline::rasterize(pts, rect, full);
+    cv::Mat1b fullImage;
+    full.toMat(fullImage);
+
+    qbitfield field;
+    field.create(cv::Size(256, 256));
+    qbitmask cell;
+
+    // a field that only touches the outline doesn't block, and the mask is completed
+    cell.create(cv::Rect(pts[0], cv::Size(1, 1)));
+    cell.setSpan(0, 0, 0);
+    field.composite(cell);
+
+    qbitmask mask;
+    BOOST_CHECK(!qscanline::rasterize(pts, rect, mask, &field));
+    cv::Mat1b image;
+    mask.toMat(image);
+    BOOST_CHECK(sameCells(image, fullImage));
+
+    // a cell of the mask in its middle row: rasterizing stops there, with the rows below left empty
+    int row = rect.height / 2;
+    int column = 0;
+    while (!fullImage(row, column))
+        ++column;
+    cell.create(cv::Rect(rect.x + column, rect.y + row, 1, 1));
+    cell.setSpan(0, 0, 0);
+    field.composite(cell);
+
+    BOOST_CHECK(qscanline::rasterize(pts, rect, mask, &field));
+    mask.toMat(image);
+    bool finished = true, unfinished = true;
+    for (int y = 0; y < rect.height; ++y)
+    {
+        for (int x = 0; x < rect.width; ++x)
+        {
+            if (y <= row)
+                finished = finished && (!image(y, x) == !fullImage(y, x));
+            else
+                unfinished = unfinished && !image(y, x);
+        }
+    }
+    BOOST_CHECK(finished);
+    BOOST_CHECK(unfinished);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+BOOST_AUTO_TEST_SUITE(qstampcache_tests)
+
+BOOST_AUTO_TEST_CASE(hits_match_rasterize)
+{
+    // scattered blocks, so some translated copies of each polygon are blocked and some aren't
+    qbitfield field;
+    field.create(cv::Size(512, 512));
+    std::mt19937 prng(2);
+    for (int i = 0; i < 40; ++i)
+    {
+        qbitmask block;
+        block.create(cv::Rect(prng() % 500, prng() % 500, 1 + prng() % 12, 1 + prng() % 12));
+        for (int y = 0; y < block.rect.height; ++y)
+            block.setSpan(y, 0, block.rect.width - 1);
+        field.composite(block);
+    }
+
+    qstampCache cache(1 << 20);
+    int blocked = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (auto const &polygon : getTestPolygons())
+        {
+            for (int i = 0; i < 20; ++i)
+            {
+                std::vector<cv::Point> pts = translate(polygon, cv::Point(i * 13, i * 11));
+                cv::Rect rect = cv::boundingRect(pts);
+
+                // no field, then the field
+                qbitmask mask, expected;
+                BOOST_CHECK(!cache.draw(pts, rect, mask));
+                qscanline::rasterize(pts, rect, expected);
+                BOOST_CHECK(mask.rect == expected.rect);
+                BOOST_CHECK(mask.words == expected.words);
+
+                bool isBlocked = qscanline::rasterize(pts, rect, expected, &field);
+                BOOST_CHECK_EQUAL(cache.draw(pts, rect, mask, &field), isBlocked);
+                if (!isBlocked)
+                    BOOST_CHECK(mask.words == expected.words);
+                blocked += isBlocked;
+            }
+        }
+    }
+    BOOST_CHECK(blocked > 0);
+
+    // one entry per polygon: every translated copy after the first is a hit
+    auto stats = cache.getStats();
+    BOOST_CHECK_EQUAL(stats.entries, getTestPolygons().size());
+    BOOST_CHECK_EQUAL(stats.misses, (long long)stats.entries);
+    BOOST_CHECK_EQUAL(stats.evictions, 0);
+}
+
+BOOST_AUTO_TEST_CASE(blocked_misses_not_cached)
+{
+    std::vector<cv::Point> pts = getTestPolygons()[0];
+    cv::Rect rect = cv::boundingRect(pts);
+
+    qbitfield field;
+    field.create(cv::Size(256, 256));
+    qbitmask mask;
+    qscanline::rasterize(pts, rect, mask);
+    field.composite(mask);
+
+    qstampCache cache(1 << 20);
+    BOOST_CHECK(cache.draw(pts, rect, mask, &field));
+    BOOST_CHECK_EQUAL(cache.getStats().entries, 0u);
+
+    // a translated copy clear of the field is cached, and then hits the blocked one
+    std::vector<cv::Point> clear = translate(pts, cv::Point(128, 128));
+    BOOST_CHECK(!cache.draw(clear, cv::boundingRect(clear), mask, &field));
+    BOOST_CHECK_EQUAL(cache.getStats().entries, 1u);
+    BOOST_CHECK(cache.draw(pts, rect, mask, &field));
+    BOOST_CHECK_EQUAL(cache.getStats().hits, 1);
+}
+
+BOOST_AUTO_TEST_CASE(eviction_keeps_results)
+{
+    // room for a handful of small entries per shard, and many more distinct shapes than that
+    qstampCache cache(16 * 1024);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            std::vector<cv::Point> pts = { { 0, 0 }, { 20 + i % 100, 4 + i / 100 }, { 5, 3 } };
+            pts = translate(pts, cv::Point(i, 2 * i));
+            cv::Rect rect = cv::boundingRect(pts);
+
+            qbitmask mask, expected;
+            cache.draw(pts, rect, mask);
+            qscanline::rasterize(pts, rect, expected);
+            BOOST_CHECK(mask.rect == expected.rect);
+            BOOST_CHECK(mask.words == expected.words);
+
+            // the entry just drawn is the most recently used, so it hasn't been evicted
+            long long hits = cache.getStats().hits;
+            cache.draw(pts, rect, mask);
+            BOOST_CHECK_EQUAL(cache.getStats().hits, hits + 1);
+            BOOST_CHECK(mask.words == expected.words);
+        }
+    }
+
+    auto stats = cache.getStats();
+    BOOST_CHECK(stats.evictions > 0);
+    BOOST_CHECK(stats.entries < 200u);
+    BOOST_CHECK(stats.bytes <= cache.getMaxBytes());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+namespace
+{
+    //  Exposes the collision settings and state of SelfLimitingPolygonTree
+    class TestPolygonTree : public SelfLimitingPolygonTree
+    {
+    public:
+        using SelfLimitingPolygonTree::ownerField;
+        using SelfLimitingPolygonTree::collisionBackend;
+        using SelfLimitingPolygonTree::m_owners;
+    };
+
+    //  Grows {tree} one node at a time until it has {maxNodes} nodes or its queue is empty
+    void growSerial(qtree &tree, qnodeStore const &nodes, size_t maxNodes)
+    {
+        while (!tree.isQueueEmpty() && nodes.size() < maxNodes)
+            tree.process();
+    }
+}
+
+
+BOOST_AUTO_TEST_SUITE(qownerfield_tests)
+
+BOOST_AUTO_TEST_CASE(remove_clears_only_owned_cells)
+{
+    TestPolygonTree tree;
+    tree.setRandomSeed(0);
+    tree.ownerField = true;
+    tree.create();
+    growSerial(tree, tree.m_nodes, 200);
+    BOOST_REQUIRE(tree.m_nodes.size() > 10);
+
+    // the newest leaf, whose parent shares one of its edges
+    std::set<int> parents;
+    for (auto const &node : tree.m_nodes)
+        parents.insert(node.parentId);
+    int id = -1;
+    for (auto const &node : tree.m_nodes)
+    {
+        if (node.id != 0 && !parents.count(node.id))
+            id = node.id;
+    }
+    BOOST_REQUIRE(id > 0);
+    int parentId = tree.findNode(id)->parentId;
+    BOOST_REQUIRE(tree.findNode(parentId));
+
+    cv::Mat1b before;
+    tree.getField().toMat(before);
+    std::vector<int> owners;
+    for (int y = 0; y < before.rows; ++y)
+        for (int x = 0; x < before.cols; ++x)
+            owners.push_back(tree.m_owners.get(x, y));
+
+    BOOST_CHECK_EQUAL(tree.removeNode(id), 1);
+    BOOST_CHECK(!tree.findNode(id));
+    BOOST_CHECK(tree.findNode(parentId));
+
+    // the removed node's cells are cleared; every other cell, the parent's included, is untouched
+    cv::Mat1b after;
+    tree.getField().toMat(after);
+    int removedCells = 0, parentCells = 0;
+    bool cleared = true, untouched = true;
+    for (int y = 0; y < before.rows; ++y)
+    {
+        for (int x = 0; x < before.cols; ++x)
+        {
+            int owner = owners[(size_t)y * before.cols + x];
+            if (owner == id)
+            {
+                removedCells++;
+                cleared = cleared && !after(y, x) && tree.m_owners.get(x, y) == qownerField::NONE;
+            }
+            else
+            {
+                parentCells += (owner == parentId);
+                untouched = untouched && (!after(y, x) == !before(y, x)) && tree.m_owners.get(x, y) == owner;
+            }
+        }
+    }
+    BOOST_CHECK(removedCells > 0);
+    BOOST_CHECK(parentCells > 0);
+    BOOST_CHECK(cleared);
+    BOOST_CHECK(untouched);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+namespace
+{
+    struct GrowthOptions
+    {
+        CollisionBackend backend = CollisionBackend::RASTER;
+        QueueEngine engine = QueueEngine::HEAP;
+        bool lazy = false;
+        bool ties = false;          // equal gestations, so many nodes are due at once
+        int batchSize = 1;          // 1: qtree::process, one node at a time
+    };
+
+    //  Committed nodes, in commit order, and the field they left
+    struct GrowthResult
+    {
+        std::vector<int> ids;
+        std::vector<int> parentIds;
+        std::vector<double> beginTimes;
+        cv::Mat1b field;
+    };
+
+    GrowthResult growSeededTree(GrowthOptions const &options, size_t maxNodes)
+    {
+        TestPolygonTree tree;
+        tree.setRandomSeed(0);
+        tree.collisionBackend = options.backend;
+        tree.queueEngine = options.engine;
+        tree.lazyChildren = options.lazy;
+        if (options.ties)
+        {
+            for (auto &t : tree.transforms)
+                t.gestation = 2.0;
+        }
+        tree.create();
+
+        if (options.batchSize > 1)
+        {
+            GrowthLimits limits;
+            limits.maxNodes = maxNodes;
+            limits.batchSize = options.batchSize;
+            GrowthStats stats;
+            growTree(tree, nullptr, limits, stats);
+        }
+        else
+        {
+            growSerial(tree, tree.m_nodes, maxNodes);
+        }
+
+        GrowthResult result;
+        for (auto const &node : tree.m_nodes)
+        {
+            result.ids.push_back(node.id);
+            result.parentIds.push_back(node.parentId);
+            result.beginTimes.push_back(node.beginTime);
+        }
+        tree.getField().toMat(result.field);
+        return result;
+    }
+
+    void checkSameGrowth(GrowthResult const &a, GrowthResult const &b)
+    {
+        BOOST_CHECK_EQUAL_COLLECTIONS(a.ids.begin(), a.ids.end(), b.ids.begin(), b.ids.end());
+        BOOST_CHECK(a.parentIds == b.parentIds);
+        BOOST_CHECK(a.beginTimes == b.beginTimes);
+        BOOST_CHECK(sameCells(a.field, b.field));
+    }
+}
+
+
+//  Batches, queue engines and lazy children change how the tree is grown, not what it grows:
+//  each is checked against serial growth on the heap engine with eager children
+BOOST_AUTO_TEST_SUITE(growth_equivalence_tests)
+
+BOOST_AUTO_TEST_CASE(batch_matches_serial)
+{
+    for (auto backend : { CollisionBackend::RASTER, CollisionBackend::ANALYTIC })
+    {
+        for (bool ties : { false, true })
+        {
+            GrowthOptions options;
+            options.backend = backend;
+            options.ties = ties;
+            GrowthResult serial = growSeededTree(options, 400);
+            BOOST_REQUIRE(serial.ids.size() > 50);
+
+            options.batchSize = 64;
+            checkSameGrowth(serial, growSeededTree(options, 400));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(calendar_matches_heap)
+{
+    for (auto backend : { CollisionBackend::RASTER, CollisionBackend::ANALYTIC })
+    {
+        for (bool ties : { false, true })
+        {
+            GrowthOptions options;
+            options.backend = backend;
+            options.ties = ties;
+            GrowthResult heap = growSeededTree(options, 400);
+
+            options.engine = QueueEngine::CALENDAR;
+            checkSameGrowth(heap, growSeededTree(options, 400));
+
+            options.batchSize = 64;
+            checkSameGrowth(heap, growSeededTree(options, 400));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lazy_matches_eager)
+{
+    for (auto backend : { CollisionBackend::RASTER, CollisionBackend::ANALYTIC })
+    {
+        for (bool ties : { false, true })
+        {
+            GrowthOptions options;
+            options.backend = backend;
+            options.ties = ties;
+            GrowthResult eager = growSeededTree(options, 400);
+
+            options.lazy = true;
+            checkSameGrowth(eager, growSeededTree(options, 400));
+
+            options.batchSize = 64;
+            checkSameGrowth(eager, growSeededTree(options, 400));
+
+            options.engine = QueueEngine::CALENDAR;
+            checkSameGrowth(eager, growSeededTree(options, 400));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 
 
 #include "util.h"
+#include "profile.h"
 #include <nlohmann/json.hpp>
 #include <opencv2/core/core.hpp>
 #include <vector>
@@ -69,6 +70,8 @@ public:
 
     cv::Scalar apply(cv::Scalar const& color) const
     {
+        PROFILE_SCOPE(ColorApply);
+
         auto hlsColor = util::cvtColor(color, cv::ColorConversionCodes::COLOR_BGR2HLS);
         return util::cvtColor(hls * hlsColor, cv::ColorConversionCodes::COLOR_HLS2BGR);
     }
@@ -236,12 +239,12 @@ inline void from_json(json const& j, ColorTransform& t)
             }
             else
             {
-                throw(std::exception("hlsTransform: unexpected parameters"));
+                throw(std::runtime_error("hlsTransform: unexpected parameters"));
             }
         }
         else
         {
-            throw(std::exception("Unknown ColorTransform"));
+            throw(std::runtime_error("Unknown ColorTransform"));
         }
     }
 }
@@ -27,8 +27,8 @@ public:
     virtual void create() override
     {
         m_rootNode.vector = iv<16, 30>();
-        m_rootNode.color = cv::Scalar(0.5, 0.5, 0.5, 1);
-        m_rootNode.globalTransform = Matx33::eye();
+        m_rootNode.setColor(cv::Scalar(0.5, 0.5, 0.5, 1));
+        m_rootNode.setTransform(Matx33::eye());
 
         polygon = { {
                 { .1f,-1}, { .08,0}, { .1, 1},
@@ -54,7 +54,7 @@ public:
 
         // clear and initialize the queue with the seed
 
-        util::clear(nodeQueue);
+        resetQueue();
         nodeQueue.push(m_rootNode);
     }
 
@@ -68,12 +68,12 @@ public:
             } };
 
         qnode rootNode;
-        rootNode.globalTransform = util::transform3x3::getTranslate(-0.5f, -0.5f);
-        rootNode.color = cv::Scalar(1, 1, 1, 1);
+        rootNode.setTransform(util::transform3x3::getTranslate(-0.5f, -0.5f));
+        rootNode.setColor(cv::Scalar(1, 1, 1, 1));
 
         // clear and initialize the queue with the seed
 
-        util::clear(nodeQueue);
+        resetQueue();
         nodeQueue.push(rootNode);
     }
 
@@ -57,7 +57,7 @@ public:
                     qtransform(-90.0, halfRoot(2), cv::Point2f(0, -0.9f))
                 } };
 
-            m_rootNode.globalTransform = util::transform3x3::getRotationMatrix2D(cv::Point2f(), 90, 1);
+            m_rootNode.setTransform(util::transform3x3::getRotationMatrix2D(cv::Point2f(), 90, 1));
 
             break;
 
@@ -72,8 +72,8 @@ public:
                     qtransform(-90.0, halfRoot(2), cv::Point2f(0, -0.9f))
                 } };
 
-            m_rootNode.globalTransform = util::transform3x3::getRotationMatrix2D(cv::Point2f(), 90, 1);
-            m_rootNode.globalTransform = util::transform3x3::getRotationMatrix2D(cv::Point2f(4.0f, 12.0f), 150.0, 7.0, 15.0f, 27.0f);
+            m_rootNode.setTransform(util::transform3x3::getRotationMatrix2D(cv::Point2f(), 90, 1));
+            m_rootNode.setTransform(util::transform3x3::getRotationMatrix2D(cv::Point2f(4.0f, 12.0f), 150.0, 7.0, 15.0f, 27.0f));
             break;
 
         case 2: // L reptiles
@@ -89,7 +89,7 @@ public:
                     qtransform(90, 0.5, cv::Point2f(0, 2))
                 } };
 
-            m_rootNode.globalTransform = util::transform3x3::getTranslate(-1, -1);
+            m_rootNode.setTransform(util::transform3x3::getTranslate(-1, -1));
             break;
 
         case 3: // 1:r3:2 right triangle reptile
@@ -147,7 +147,7 @@ public:
                     qtransform{ util::transform3x3::getRotate(9 * astep) * util::transform3x3::getScaleTranslate(0.5f, 0.0f, 1.0f), ColorTransform::rgbSink(Matx41(9,4,0,1)*0.111f, 0.7f) }
                 } };
 
-            m_rootNode.color = cv::Scalar(0.5f, 0.75f, 1, 1);
+            m_rootNode.setColor(cv::Scalar(0.5f, 0.75f, 1, 1));
 
             break;
         }
@@ -174,7 +174,7 @@ public:
                     qtransform(util::transform3x3::getRotate(5 * angle) * util::transform3x3::getScaleTranslate(0.5f, 0.0f, 1.0f), ColorTransform::rgbSink(Matx41(2,0,9,1)*0.111f, 0.7f))
                 } };
 
-            m_rootNode.color = cv::Scalar(1, 1, 1, 1);
+            m_rootNode.setColor(cv::Scalar(1, 1, 1, 1));
 
             break;
         }
@@ -191,7 +191,7 @@ public:
                     qtransform(util::transform3x3::getEdgeMap(polygon[0], polygon[1], polygon[0], polygon[3]), ColorTransform::rgbSink(Matx41(9,0,0,1)*0.111f, 0.2f))
                 } };
 
-            m_rootNode.color = cv::Scalar(1, 1, 1, 1);
+            m_rootNode.setColor(cv::Scalar(1, 1, 1, 1));
 
             break;
         }
@@ -214,12 +214,12 @@ public:
 
     virtual void create() override
     {
-        m_rootNode.color = cv::Scalar(0.5, 0.5, 0.5, 1);
-        m_rootNode.globalTransform = Matx33::eye();
+        m_rootNode.setColor(cv::Scalar(0.5, 0.5, 0.5, 1));
+        m_rootNode.setTransform(Matx33::eye());
 
         // clear and initialize the queue with the seed
 
-        util::clear(nodeQueue);
+        resetQueue();
         nodeQueue.push(m_rootNode);
     }
 
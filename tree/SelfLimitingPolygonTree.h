@@ -2,14 +2,18 @@
 
 
 #include "tree.h"
+#include "qnodestore.h"
+#include "qstampcache.h"
+#include "qpolygonindex.h"
+#include "qownerfield.h"
 #include "util.h"
 #include <vector>
+#include <unordered_map>
 #include <iostream>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/core/utility.hpp>
 #include <array>
-#include <list>
-#include <unordered_set>
 #include <filesystem>
 
 
@@ -28,6 +32,14 @@ using std::endl;
 //  These models limit growth by prohibiting self-intersection
 
 
+//  How candidate nodes are tested for intersection with committed nodes
+enum class CollisionBackend
+{
+    RASTER,     // rasterized occupancy field, at fieldResolution cells per model unit
+    ANALYTIC    // exact polygon tests in model coordinates
+};
+
+
 #pragma region SelfLimitingPolygonTree
 
 class SelfLimitingPolygonTree : public qtree
@@ -49,16 +61,41 @@ protected:
     // minimum size (relative to rootNode) for new nodes to be considered viable
     float minimumScale = 0.01f; 
 
+    // memory bound for cached collision masks; 0 disables the cache
+    size_t stampCacheBytes = 16 << 20;
+
+    // adaptive refinement: candidates spanning fewer than refineThreshold field cells are rasterized on a
+    // field refineFactor (2, 4 or 8) times finer, allocated only in the tiles where they grow. 1 disables it.
+    int refineFactor = 1;
+    int refineThreshold = 8;
+
+    // raster backend: record the node owning each field cell, for direct picking and exact removal
+    bool ownerField = false;
+
+    CollisionBackend collisionBackend = CollisionBackend::RASTER;
+    // analytic backend: broadphase grid cell size in model units (0: automatic), and contact tolerance
+    double collisionCellSize = 0.0;
+    double collisionEpsilon = 1e-4;
+
     std::vector<ColorTransform> colorTransformPalette;
 
     // --- model ---
 
-    // intersection field
-    cv::Mat1b m_field;
+    // intersection field: sparse 64x64 tiles, one bit per cell, with tile occupancy for early accept/reject
+    qbitfield m_field;
     Matx33 m_fieldTransform;
-    // temp drawing layer, same size as field, for drawing individual nodes and checking for intersection
-    mutable cv::Mat1b m_fieldLayer;
-    mutable cv::Rect m_fieldLayerBoundingRect;
+    // refined field, refineFactor times finer. each m_field tile is held by one field or the other:
+    // a tile's cells move here, upsampled, when a small node is first committed to it
+    qbitfield m_fineField;
+    std::vector<uint8_t> m_refinedTiles;        // by m_field tile
+    // owning node id of each base field cell, if ownerField is set, and of each refined field cell
+    // claimed by a small node, so small nodes sharing a base cell are told apart
+    qownerField m_owners;
+    qownerField m_fineOwners;
+    // collision masks by shape, shared by nodes that differ only by translation. internally synchronized
+    mutable qstampCache m_stampCache;
+    // committed node polygons, for the analytic backend
+    qpolygonIndex m_polygonIndex;
 
 public:
 
@@ -79,6 +116,18 @@ public:
 
         if (!fieldImagePath.empty())
             j["fieldImage"] = fieldImagePath.string();
+
+        j["stampCache"] = json{ { "maxBytes", stampCacheBytes } };
+
+        j["refinement"] = json{ { "factor", refineFactor }, { "threshold", refineThreshold } };
+
+        j["ownerField"] = ownerField;
+
+        j["collision"] = json{
+            { "backend", (collisionBackend == CollisionBackend::ANALYTIC ? "analytic" : "raster") },
+            { "cellSize", collisionCellSize },
+            { "epsilon", collisionEpsilon }
+        };
         
         ::to_json(j["rootNode"]["color"], rootNodeColor);
     }
@@ -95,6 +144,37 @@ public:
             fieldImagePath = j.at("fieldImage").get<string>();
 
         fieldResolution = j.at("fieldResolution");
+
+        stampCacheBytes = 16 << 20;
+        if (j.contains("stampCache") && j.at("stampCache").contains("maxBytes"))
+            stampCacheBytes = j.at("stampCache").at("maxBytes").get<size_t>();
+
+        refineFactor = 1;
+        refineThreshold = 8;
+        if (j.contains("refinement"))
+        {
+            auto const &jr = j.at("refinement");
+            if (jr.contains("factor"))
+                refineFactor = jr.at("factor").get<int>();
+            if (jr.contains("threshold"))
+                refineThreshold = jr.at("threshold").get<int>();
+        }
+
+        ownerField = (j.contains("ownerField") ? j.at("ownerField").get<bool>() : false);
+
+        collisionBackend = CollisionBackend::RASTER;
+        collisionCellSize = 0.0;
+        collisionEpsilon = 1e-4;
+        if (j.contains("collision"))
+        {
+            auto const &jc = j.at("collision");
+            if (jc.contains("backend"))
+                collisionBackend = (jc.at("backend") == string("analytic") ? CollisionBackend::ANALYTIC : CollisionBackend::RASTER);
+            if (jc.contains("cellSize"))
+                collisionCellSize = jc.at("cellSize").get<double>();
+            if (jc.contains("epsilon"))
+                collisionEpsilon = jc.at("epsilon").get<double>();
+        }
         polygonSides = (j.contains("polygonSides") ? j.at("polygonSides").get<int>() : 5);
         starAngle    = (j.contains("starAngle"   ) ? j.at("starAngle"   ).get<float>() : 0);
         
@@ -202,18 +282,42 @@ public:
 
     virtual void create() override
     {
-        // initialize intersection field
         auto rc = getBoundingRect();
-        auto fieldSize = rc.size() * (float)fieldResolution;
+
+        if (collisionBackend == CollisionBackend::ANALYTIC)
+        {
+            if (!fieldImagePath.empty())
+                throw(std::runtime_error("fieldImage requires the raster collision backend"));
+
+            double cellSize = (collisionCellSize > 0.0 ? collisionCellSize : std::max(rc.width, rc.height) / 256.0);
+            m_polygonIndex.create(rc, cellSize, cv::isContourConvex(polygon), collisionEpsilon);
+        }
+        else
+        {
+            m_polygonIndex.clear();
+        }
+
+        // initialize intersection field
+        cv::Size fieldSize = (collisionBackend == CollisionBackend::RASTER ? cv::Size(rc.size() * (float)fieldResolution) : cv::Size());
         m_field.create(fieldSize);
-        m_field = 0;
-        m_field.copyTo(m_fieldLayer);
+        m_stampCache.setMaxBytes(collisionBackend == CollisionBackend::RASTER ? stampCacheBytes : 0);
+
+        if (refineFactor != 1 && refineFactor != 2 && refineFactor != 4 && refineFactor != 8)
+            throw(std::runtime_error("refinement factor must be 1, 2, 4 or 8"));
+        bool refine = (collisionBackend == CollisionBackend::RASTER && refineFactor > 1);
+        m_fineField.create(refine ? fieldSize * refineFactor : cv::Size());
+        m_refinedTiles.assign(refine ? (size_t)((fieldSize.width + 63) >> 6) * ((fieldSize.height + 63) >> 6) : 0, 0);
+
+        m_owners.create(ownerField ? fieldSize : cv::Size());
+        m_fineOwners.create(ownerField && refine ? fieldSize * refineFactor : cv::Size());
 
         if (!fieldImagePath.empty())
         {
             cv::Mat fieldImage = cv::imread(fieldImagePath.string());
             cv::cvtColor(fieldImage, fieldImage, cv::ColorConversionCodes::COLOR_BGR2GRAY);
-            cv::resize(fieldImage, m_field, m_field.size(), 0, 0, cv::InterpolationFlags::INTER_NEAREST);
+            cv::Mat1b fieldMask;
+            cv::resize(fieldImage, fieldMask, fieldSize, 0, 0, cv::InterpolationFlags::INTER_NEAREST);
+            m_field.fromMat(fieldMask);
         }
 
         //int x = fieldSize.width / 4;
@@ -231,10 +335,10 @@ public:
         qnode rootNode;
         createRootNode(rootNode);
 
-        util::clear(nodeQueue);
+        resetQueue();
         nodeQueue.push(rootNode);
 
-        m_nodeList.clear();
+        m_nodes.clear();
     }
 
     virtual void createRootNode(qnode & rootNode)
@@ -242,306 +346,722 @@ public:
         rootNode.id = 0;
         rootNode.parentId = 0;
         rootNode.beginTime = 0;
-        rootNode.color = rootNodeColor;
+        rootNode.setColor(rootNodeColor);
 
         // center root node at origin
         auto centroid = util::polygon::centroid(polygon);
-        rootNode.globalTransform = util::transform3x3::getScaleTranslate(1.0f, -centroid.x, -centroid.y);
+        rootNode.setTransform(util::transform3x3::getScaleTranslate(1.0f, -centroid.x, -centroid.y));
     }
 
-    virtual void beget(qnode const & parent, qtransform const & t, qnode & child) override
+    virtual bool isViable(qnode const &node) const override
     {
-        qtree::beget(parent, t, child);
-
-        // apply affine transform in HLS space
-        child.color = t.colorTransform.apply(parent.color);
+        qcandidate candidate(node);
+        return evaluate(candidate);
     }
 
-
-    virtual bool isViable(qnode const &node) const override
+    //  Raster backend: rasterizes the candidate into its own field mask, testing each row against the field
+    //  as it goes. A blocked candidate stops at its first overlapping row, leaving its mask unfinished.
+    //  Analytic backend: tests the candidate's model polygon against nearby committed polygons.
+    //  Touches no shared state, so candidates can be evaluated concurrently.
+    virtual bool evaluate(qcandidate &candidate) const override
     {
-        if (!node) 
+        candidate.viable = false;
+
+        if (!candidate.node)
             return false;
 
-        if (fabs(node.det()) < minimumScale*minimumScale)
+        if (fabs(candidate.node.det()) < minimumScale*minimumScale)
             return false;
 
-        if (!drawField(node))
+        if (collisionBackend == CollisionBackend::ANALYTIC)
+        {
+            if (!getModelPolygon(candidate))
+                return false;   // out of bounds
+
+            PROFILE_SCOPE(Collision);
+            candidate.viable = !m_polygonIndex.intersects(candidate.modelPoints);
+            return candidate.viable;
+        }
+
+        PROFILE_SCOPE(Rasterize);
+
+        if (!getFieldPolygon(candidate))
             return false;   // out of image bounds
 
-        thread_local cv::Mat andmat;
-        cv::bitwise_and(m_field(m_fieldLayerBoundingRect), m_fieldLayer(m_fieldLayerBoundingRect), andmat);
-        return(!cv::countNonZero(andmat));
+        candidate.fieldVersion = getFieldVersion(candidate);
+        if (candidate.fieldLevel == 0)
+        {
+            candidate.viable = !m_stampCache.draw(candidate.fieldPoints, candidate.fieldRect, candidate.fieldMask, &m_field)
+                && !intersectsRefined(candidate.fieldMask);
+        }
+        else
+        {
+            candidate.viable = !m_stampCache.draw(candidate.fieldPoints, candidate.fieldRect, candidate.fieldMask, &m_fineField)
+                && !intersectsBase(candidate.fieldMask);
+        }
+        return candidate.viable;
     }
 
-    //  draw node on field stage layer to prepare for collision detection
-    //  full collision detection is not done here, but this function returns false if out-of-bounds or other
-    //  quick detection means that this node is not viable.
-    bool drawField(qnode const &node) const
+    //  Adds the candidate's mask or polygon to the collision state and queues its children
+    virtual void commit(qcandidate &candidate) override
     {
-        vector<cv::Point2f> v;
+        // update field image: composite new node
+        {
+            PROFILE_SCOPE(Composite);
+            if (collisionBackend == CollisionBackend::ANALYTIC)
+                m_polygonIndex.insert(candidate.node.id, candidate.modelPoints);
+            else
+                composite(candidate);
+        }
+
+        addCommitted(candidate);
+    }
+
+    //  Sets the cells of an evaluated candidate's mask. A small node refines its tiles first; a base
+    //  node's cells on refined tiles are moved to the refined field.
+    void composite(qcandidate const &candidate)
+    {
+        if (candidate.fieldLevel == 0)
+        {
+            m_field.composite(candidate.fieldMask);
+            if (!m_fineField.empty())
+                refine(candidate.fieldRect, true);
+            if (!m_owners.empty())
+                m_owners.claim(candidate.fieldMask, candidate.node.id);
+            return;
+        }
+
+        refine(getBaseRect(candidate), false);
+        m_fineField.composite(candidate.fieldMask);
+        if (!m_fineOwners.empty())
+            m_fineOwners.claim(candidate.fieldMask, candidate.node.id);
+    }
+
+    //  Records a candidate whose collision state has been committed, and queues its children
+    void addCommitted(qcandidate &candidate)
+    {
+        qtree::addNode(candidate.node);
 
-        // first, transform node polygon to model coordinates
-        cv::transform(polygon, v, node.globalTransform.get_minor<2, 3>(0, 0));
+        m_nodes.add(candidate.node);
+
+        pushChildren(candidate.node);
+    }
+
+    //  Computes the candidate's model and field vertices and draws its complete collision mask,
+    //  without testing it. Returns false if the node is out of bounds.
+    bool rasterize(qcandidate &candidate) const
+    {
+        PROFILE_SCOPE(Rasterize);
+
+        if (!getFieldPolygon(candidate))
+            return false;
+
+        m_stampCache.draw(candidate.fieldPoints, candidate.fieldRect, candidate.fieldMask);
+        return true;
+    }
+
+    //  Node polygon in model coordinates. Returns false if the node is out of bounds.
+    bool getModelPolygon(qcandidate &candidate) const
+    {
+        cv::transform(polygon, candidate.modelPoints, candidate.node.globalTransform);
 
         // test each vertex against maxRadius
-        for (auto const& p : v)
+        for (auto const& p : candidate.modelPoints)
             if(!isPointInBounds(p))
                 return false;
 
+        return true;
+    }
+
+    //  Node polygon in model coordinates, and in (integer) field coordinates with its bounding rect.
+    //  Returns false if the node is out of bounds.
+    bool getFieldPolygon(qcandidate &candidate) const
+    {
+        if (!getModelPolygon(candidate))
+            return false;
+
         // transform model polygon to field coords
-        Matx33 m = m_fieldTransform * node.globalTransform;
+        Matx33 m = m_fieldTransform * candidate.node.getTransform();
+        vector<cv::Point2f> v;
         cv::transform(polygon, v, m.get_minor<2, 3>(0, 0));
-        // convert to int-coordinate struct for cv::polylines
-        vector<vector<cv::Point> > pts(1);
+        // convert to integer field cells
+        candidate.fieldPoints.clear();
         for (auto const& p : v)
-            pts[0].push_back(p);
+            candidate.fieldPoints.push_back(p);
 
         // (double) check that coords are within field
-        m_fieldLayerBoundingRect = cv::boundingRect(pts[0]);
-        if ((cv::Rect(0, 0, m_field.cols, m_field.rows) & m_fieldLayerBoundingRect) != m_fieldLayerBoundingRect)
+        candidate.fieldLevel = 0;
+        candidate.fieldRect = cv::boundingRect(candidate.fieldPoints);
+        if ((cv::Rect(0, 0, m_field.cols(), m_field.rows()) & candidate.fieldRect) != candidate.fieldRect)
             return false;
 
-        // clear a region of our scratch layer and draw node on it
-        m_fieldLayer(m_fieldLayerBoundingRect) = 0;
-        cv::fillPoly(m_fieldLayer, pts, cv::Scalar(255), cv::LineTypes::LINE_8);
-        // reduce by drawing outline in black:
-        // this is a bit of a hack to get around the problem of OpenCV always drawing a pixel-wide boundary even when only a fill is specified
-        cv::polylines(m_fieldLayer, pts, true, cv::Scalar(0), 1, cv::LineTypes::LINE_8);
-        // double-draw and soften the line--purely for aesthetics, since the field layer is exported as well
-        cv::polylines(m_fieldLayer, pts, true, cv::Scalar(0), 1, cv::LineTypes::LINE_AA);
+        // small nodes use the refined field
+        if (!m_fineField.empty() && std::max(candidate.fieldRect.width, candidate.fieldRect.height) < refineThreshold)
+        {
+            // fine cells {refineFactor * k .. refineFactor * k + refineFactor - 1} subdivide base cell {k}
+            int f = refineFactor;
+            Matx33 mf = util::transform3x3::getScaleTranslate((float)f, 0.5f * (f - 1), 0.5f * (f - 1)) * m;
+            cv::transform(polygon, v, mf.get_minor<2, 3>(0, 0));
+
+            // clamp rounding ties, so the fine polygon stays within the base polygon's cells
+            cv::Rect const &rc = candidate.fieldRect;
+            candidate.fieldPoints.clear();
+            for (auto const& p : v)
+            {
+                cv::Point pt = p;
+                pt.x = std::min(std::max(pt.x, rc.x * f), (rc.x + rc.width) * f - 1);
+                pt.y = std::min(std::max(pt.y, rc.y * f), (rc.y + rc.height) * f - 1);
+                candidate.fieldPoints.push_back(pt);
+            }
+
+            candidate.fieldLevel = 1;
+            candidate.fieldRect = cv::boundingRect(candidate.fieldPoints);
+        }
 
         return true;
     }
 
-    void undrawNode(qnode &node)
+#pragma region Refinement
+
+    //  The candidate's bounding rect in base field cells
+    cv::Rect getBaseRect(qcandidate const &candidate) const
     {
-        drawField(node);
-        cv::bitwise_not(m_fieldLayer(m_fieldLayerBoundingRect), m_fieldLayer(m_fieldLayerBoundingRect));
-        cv::bitwise_and(m_field(m_fieldLayerBoundingRect), m_fieldLayer(m_fieldLayerBoundingRect), m_field(m_fieldLayerBoundingRect));
+        cv::Rect const &rc = candidate.fieldRect;
+        if (candidate.fieldLevel == 0 || rc.area() == 0)
+            return rc;
+
+        int f = refineFactor;
+        int x0 = rc.x / f, y0 = rc.y / f;
+        int x1 = (rc.x + rc.width - 1) / f, y1 = (rc.y + rc.height - 1) / f;
+        return cv::Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
     }
 
-    std::list<qnode> m_nodeList;
-    std::unordered_set<int> m_markedForDeletion;
+    //  true if any tile under {rect} (base field cells) is refined
+    bool isRefined(cv::Rect const &rect) const
+    {
+        cv::Rect tiles = qbitfield::getTileRect(rect);
+        size_t stride = ((size_t)m_field.cols() + 63) >> 6;
+        for (int by = tiles.y; by < tiles.y + tiles.height; ++by)
+            for (int bx = tiles.x; bx < tiles.x + tiles.width; ++bx)
+                if (m_refinedTiles[by * stride + bx])
+                    return true;
+        return false;
+    }
 
-    virtual void addNode(qnode &currentNode) override
+    //  Moves the base field cells of tiles under {rect} (base field cells) to the refined field, upsampled.
+    //  Unrefined tiles are refined, unless {refinedOnly}.
+    void refine(cv::Rect const &rect, bool refinedOnly)
     {
-        qtree::addNode(currentNode);
+        cv::Rect tiles = qbitfield::getTileRect(rect);
+        size_t stride = ((size_t)m_field.cols() + 63) >> 6;
+        for (int by = tiles.y; by < tiles.y + tiles.height; ++by)
+        {
+            for (int bx = tiles.x; bx < tiles.x + tiles.width; ++bx)
+            {
+                auto &refined = m_refinedTiles[by * stride + bx];
+                if (!refined && refinedOnly)
+                    continue;
+
+                // the tile is one word column, so each row is one word
+                cv::Rect base = cv::Rect(bx << 6, by << 6, 64, 64) & cv::Rect(0, 0, m_field.cols(), m_field.rows());
+                qbitmask coarse, fine;
+                coarse.create(base);
+                for (int y = 0; y < base.height; ++y)
+                    coarse.getWord(y, 0) = m_field.getWord(base.y + y, bx);
+                upsample(coarse, fine);
+
+                m_fineField.composite(fine);
+                m_field.erase(coarse);
+                refined = 1;
+            }
+        }
+    }
 
-        m_nodeList.push_back(currentNode);
+    //  Refined mask of base mask {coarse}: each base cell sets all of its fine cells
+    void upsample(qbitmask const &coarse, qbitmask &fine) const
+    {
+        int f = refineFactor;
+        cv::Rect const &rc = coarse.rect;
+        fine.create(cv::Rect(rc.x * f, rc.y * f, rc.width * f, rc.height * f));
+        forEachRun(coarse, [&](int y, int x0, int x1)
+        {
+            for (int i = 0; i < f; ++i)
+                fine.setSpan(y * f + i, x0 * f, x1 * f + f - 1);
+        });
+    }
 
-        // update field image: composite new node
-        cv::bitwise_or(m_field(m_fieldLayerBoundingRect), m_fieldLayer(m_fieldLayerBoundingRect), m_field(m_fieldLayerBoundingRect));
+    //  Base mask of refined mask {fine}: a base cell is set if any of its fine cells is
+    void downsample(qbitmask const &fine, qbitmask &coarse) const
+    {
+        int f = refineFactor;
+        cv::Rect const &rc = fine.rect;
+        int x0 = rc.x / f, y0 = rc.y / f;
+        coarse.create(cv::Rect(x0, y0, (rc.x + rc.width - 1) / f - x0 + 1, (rc.y + rc.height - 1) / f - y0 + 1));
+        forEachRun(fine, [&](int y, int b0, int b1)
+        {
+            coarse.setSpan((rc.y + y) / f - y0, (rc.x + b0) / f - x0, (rc.x + b1) / f - x0);
+        });
     }
 
-    std::list<qnode>::const_iterator findNode(int id) const
+    //  Calls {fn(y, x0, x1)} for each run of set cells [x0, x1] of each row of {mask}, in mask coordinates.
+    //  Runs crossing a word boundary are reported in parts.
+    template<typename _Fn>
+    static void forEachRun(qbitmask const &mask, _Fn fn)
     {
-        for (auto it = m_nodeList.begin(); it!=m_nodeList.end(); ++it)
+        int bitOffset = mask.getBitOffset();
+        for (int y = 0; y < mask.rect.height; ++y)
         {
-            if (it->id == id)
+            for (int i = 0; i < mask.stride; ++i)
             {
-                return it;
+                uint64_t bits = mask.getWord(y, i);
+                while (bits)
+                {
+                    int b0 = std::countr_zero(bits);
+                    int b1 = b0 + std::countr_one(bits >> b0) - 1;
+                    fn(y, (i << 6) + b0 - bitOffset, (i << 6) + b1 - bitOffset);
+                    bits &= bits + (uint64_t(1) << b0);     // clear the run
+                }
             }
         }
-        return m_nodeList.end();
     }
 
-    std::list<qnode>::iterator findNode(int id)
+    //  true if a refined mask overlaps the base field
+    bool intersectsBase(qbitmask const &fine) const
+    {
+        thread_local qbitmask coarse;
+        downsample(fine, coarse);
+        return m_field.intersects(coarse);
+    }
+
+    //  true if a base mask overlaps the refined field
+    bool intersectsRefined(qbitmask const &coarse) const
     {
-        for (auto it = m_nodeList.begin(); it != m_nodeList.end(); ++it)
+        if (m_fineField.empty() || !isRefined(coarse.rect))
+            return false;
+
+        thread_local qbitmask fine;
+        upsample(coarse, fine);
+        return m_fineField.intersects(fine);
+    }
+
+    //  Combined version of both fields under the candidate
+    uint64_t getFieldVersion(qcandidate const &candidate) const
+    {
+        cv::Rect base = getBaseRect(candidate);
+        uint64_t version = m_field.getVersion(base);
+        if (!m_fineField.empty())
+        {
+            int f = refineFactor;
+            version += m_fineField.getVersion(cv::Rect(base.x * f, base.y * f, base.width * f, base.height * f));
+        }
+        return version;
+    }
+
+    //  8-bit image of the base field, with refined tiles downsampled: a cell is set if any of its fine cells is
+    void getFieldImage(cv::Mat1b &image) const
+    {
+        m_field.toMat(image);
+        if (m_fineField.empty())
+            return;
+
+        int f = refineFactor;
+        for (int y = 0; y < m_fineField.rows(); ++y)
         {
-            if (it->id == id)
+            for (int wx = 0; (wx << 6) < m_fineField.cols(); ++wx)
             {
-                return it;
+                uint64_t bits = m_fineField.getWord(y, wx);
+                while (bits)
+                {
+                    int x = (wx << 6) + std::countr_zero(bits);
+                    image(y / f, x / f) = 255;
+                    bits &= bits - 1;
+                }
             }
         }
-        return m_nodeList.end();
     }
 
-    void getLineage(qnode const & node, std::vector<string> & lineage) const override
+#pragma endregion
+
+    //  true if the candidate overlaps a committed node
+    bool isBlocked(qcandidate const &candidate) const
     {
-        lineage.clear();
-        lineage.push_back(node.sourceTransform);
-        int id = node.parentId;
-        while (id != 0)
+        PROFILE_SCOPE(Collision);
+        if (collisionBackend == CollisionBackend::ANALYTIC)
+            return m_polygonIndex.intersects(candidate.modelPoints);
+        if (candidate.fieldLevel == 1)
+            return m_fineField.intersects(candidate.fieldMask) || intersectsBase(candidate.fieldMask);
+        return m_field.intersects(candidate.fieldMask) || intersectsRefined(candidate.fieldMask);
+    }
+
+    //  Bounding rect of an evaluated candidate, in the backend's coordinates
+    cv::Rect2f getCollisionBounds(qcandidate const &candidate) const
+    {
+        if (collisionBackend == CollisionBackend::RASTER)
+            return cv::Rect2f(getBaseRect(candidate));
+
+        auto const &pts = candidate.modelPoints;
+        float x0 = pts[0].x, y0 = pts[0].y, x1 = x0, y1 = y0;
+        for (auto const &p : pts)
+        {
+            x0 = std::min(x0, p.x); x1 = std::max(x1, p.x);
+            y0 = std::min(y0, p.y); y1 = std::max(y1, p.y);
+        }
+        return cv::Rect2f(x0, y0, x1 - x0, y1 - y0);
+    }
+
+#pragma region Batch processing
+
+    //  Evaluates a batch of candidates concurrently against the current field, then commits them.
+    //  A candidate is re-tested only if nodes committed earlier in the same batch may have changed the
+    //  field under it, so the result is identical to serial processing. Candidates rejected on evaluation
+    //  are never re-tested, here or in commitByTiles(): the field only gains cells within a batch.
+    virtual int processBatch(int maxNodes, std::vector<qnode> *committed = nullptr, int *popped = nullptr) override
+    {
+        std::vector<qnode> batch;
+        popBatch(maxNodes, batch);
+        if (popped)
+            *popped = (int)batch.size();
+
+        std::vector<qcandidate> candidates(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+            candidates[i].node = batch[i];
+
+        class EvaluateBody : public cv::ParallelLoopBody
         {
-            auto it = findNode(id);
-            if (it == m_nodeList.end())
+            SelfLimitingPolygonTree const &tree;
+            std::vector<qcandidate> &candidates;
+        public:
+            EvaluateBody(SelfLimitingPolygonTree const &tree_, std::vector<qcandidate> &candidates_)
+                : tree(tree_), candidates(candidates_) { }
+
+            virtual void operator()(cv::Range const &range) const override
             {
-                cout << "Parent id not found:>" << id << endl;
-                return;
+                for (int i = range.start; i < range.end; ++i)
+                    tree.evaluate(candidates[i]);
             }
-            lineage.push_back(it->sourceTransform);
-            id = it->parentId;
+        };
+
+        cv::parallel_for_(cv::Range(0, (int)candidates.size()), EvaluateBody(*this, candidates));
+
+        if (collisionBackend == CollisionBackend::RASTER)
+            return commitByTiles(candidates, committed);
+
+        int nodesAdded = 0;
+        std::vector<cv::Rect2f> committedRects;
+        for (auto &candidate : candidates)
+        {
+            if (!candidate.viable)
+                continue;
+
+            cv::Rect2f bounds = getCollisionBounds(candidate);
+            for (auto const &rc : committedRects)
+            {
+                if ((rc & bounds).area() > 0)
+                {
+                    candidate.viable = !isBlocked(candidate);
+                    break;
+                }
+            }
+            if (!candidate.viable)
+                continue;
+
+            commit(candidate);
+
+            committedRects.push_back(bounds);
+            nodesAdded++;
+            if (committed)
+                committed->push_back(candidate.node);
         }
+
+        return nodesAdded;
     }
 
-    virtual void getNodesIntersecting(cv::Rect2f const &rect, std::vector<qnode> &nodes) const override
+    //  Commits evaluated candidates to the field concurrently, in waves of candidates whose tiles are
+    //  disjoint. A candidate's wave follows the waves of all earlier candidates sharing a tile with it,
+    //  so when it is committed, the field under it is exactly as serial processing would leave it.
+    //  It is re-tested only if its tiles' version changed since it was evaluated.
+    //  Nodes are then added and their children queued serially, in queue order.
+    int commitByTiles(std::vector<qcandidate> &candidates, std::vector<qnode> *committed)
     {
-        for (auto & node : m_nodeList)
+        // assign waves: one past the latest wave of any earlier candidate on the same tiles
+        std::vector<std::vector<int> > waves;
+        std::unordered_map<size_t, int> tileWaves;      // tile -> latest wave + 1
+        size_t tileStride = ((size_t)m_field.cols() + 63) >> 6;
+        for (int i = 0; i < (int)candidates.size(); ++i)
         {
-            std::vector<cv::Point2f> pts;
-            getPolyPoints(node, pts);
+            if (!candidates[i].viable)
+                continue;
 
-            if (cv::pointPolygonTest(pts, rect.tl(), false) >= 0.0)
+            cv::Rect tiles = qbitfield::getTileRect(getBaseRect(candidates[i]));
+            int wave = 0;
+            for (int by = tiles.y; by < tiles.y + tiles.height; ++by)
             {
-                nodes.push_back(node);
+                for (int bx = tiles.x; bx < tiles.x + tiles.width; ++bx)
+                {
+                    auto it = tileWaves.find(by * tileStride + bx);
+                    if (it != tileWaves.end())
+                        wave = std::max(wave, it->second);
+                }
             }
-            else
+            for (int by = tiles.y; by < tiles.y + tiles.height; ++by)
+                for (int bx = tiles.x; bx < tiles.x + tiles.width; ++bx)
+                    tileWaves[by * tileStride + bx] = wave + 1;
+
+            if (wave == (int)waves.size())
+                waves.emplace_back();
+            waves[wave].push_back(i);
+        }
+
+        class CommitBody : public cv::ParallelLoopBody
+        {
+            SelfLimitingPolygonTree &tree;
+            std::vector<qcandidate> &candidates;
+            std::vector<int> const &wave;
+        public:
+            CommitBody(SelfLimitingPolygonTree &tree_, std::vector<qcandidate> &candidates_, std::vector<int> const &wave_)
+                : tree(tree_), candidates(candidates_), wave(wave_) { }
+
+            virtual void operator()(cv::Range const &range) const override
             {
-                // this is not a proper intersection
-                for (auto const& pt : pts)
+                for (int i = range.start; i < range.end; ++i)
                 {
-                    if (rect.contains(pt))
+                    qcandidate &candidate = candidates[wave[i]];
+                    if (tree.getFieldVersion(candidate) != candidate.fieldVersion)
+                        candidate.viable = !tree.isBlocked(candidate);
+                    if (candidate.viable)
                     {
-                        nodes.push_back(node);
-                        break;
+                        PROFILE_SCOPE(Composite);
+                        tree.composite(candidate);
                     }
                 }
             }
+        };
+
+        for (auto const &wave : waves)
+        {
+            CommitBody body(*this, candidates, wave);
+            if (wave.size() > 1)
+                cv::parallel_for_(cv::Range(0, (int)wave.size()), body);
+            else
+                body(cv::Range(0, (int)wave.size()));
+        }
+
+        int nodesAdded = 0;
+        for (auto &candidate : candidates)
+        {
+            if (!candidate.viable)
+                continue;
+
+            addCommitted(candidate);
+
+            nodesAdded++;
+            if (committed)
+                committed->push_back(candidate.node);
         }
+
+        return nodesAdded;
     }
 
-    virtual int removeNode(int id) override
+#pragma endregion
+
+    void undrawNode(qnode const &node)
     {
-        auto it = m_nodeList.begin();
-        if(id>=0)
-            it = findNode(id);
+        if (collisionBackend == CollisionBackend::ANALYTIC)
+        {
+            m_polygonIndex.remove(node.id);
+            return;
+        }
 
-        if (it == m_nodeList.end())
+        qcandidate candidate(node);
+        if (!m_owners.empty())
         {
-            // not found
-            return 0;
+            // clear exactly the cells the node claimed, in the field it was committed to
+            if (!getFieldPolygon(candidate))
+                return;
+            qbitmask owned;
+            if (candidate.fieldLevel == 1)
+            {
+                m_fineOwners.release(candidate.fieldRect, node.id, owned);
+                m_fineField.erase(owned);
+                return;
+            }
+            m_owners.release(candidate.fieldRect, node.id, owned);
+            m_field.erase(owned);
+            if (m_fineField.empty())
+                return;
         }
-        cout << " -- removing " << (it->id) << " from " << (it->parentId) << " remaining: " << m_nodeList.size() << endl;
-        undrawNode(*it);
-        it = m_nodeList.erase(it);
-        return 1;
-        /*
-        m_markedForDeletion.clear();
-        m_markedForDeletion.insert(id);
 
-        markDescendantsForDeletion();
+        // without owners, or for a base node's cells moved to refined tiles: masks never overlap,
+        // so the node's own mask is exact
+        if (!rasterize(candidate))
+            return;
 
-        int removed = 0;
-        for (auto it = m_nodeList.begin(); it != m_nodeList.end(); )
+        if (candidate.fieldLevel == 1)
         {
-            if (m_markedForDeletion.find(it->id) != m_markedForDeletion.end())
-            {
-                cout << " -- removing " << (it->id) << " from " << (it->parentId) << endl;
-                undrawNode(*it);
+            m_fineField.erase(candidate.fieldMask);
+            return;
+        }
 
-                it = m_nodeList.erase(it);
-                ++removed;
-            }
-            else
-            {
-                ++it;
-            }
+        if (m_owners.empty())
+            m_field.erase(candidate.fieldMask);
+        if (!m_fineField.empty())
+        {
+            qbitmask fine;
+            upsample(candidate.fieldMask, fine);
+            m_fineField.erase(fine);
         }
+    }
 
-        m_markedForDeletion.clear();
+    qnodeStore m_nodes;
 
-        //sprout();
+    qstampCache::Stats getStampCacheStats() const
+    {
+        return m_stampCache.getStats();
+    }
 
-        return removed;//*/
+    //  bytes held by the intersection field, which grows with the occupied area
+    size_t getFieldMemorySize() const
+    {
+        return m_field.getMemorySize() + m_fineField.getMemorySize() + m_refinedTiles.size()
+            + m_owners.getMemorySize() + m_fineOwners.getMemorySize();
     }
 
-    //bool isDescendantOf(int child, int ancestor)
-    //{
-    //    auto it = findNode(child);
-    //    while (it!=m_nodeList.end())
-    //    {
-    //        if(it->id==ancestor)
-    //            return true;
-    //        if (it->parentId == it->id)
-    //            return false;
-    //        it = findNode(it->parentId);
-    //    }
-    //    // ??
-    //    return false;
-    //}
+    qbitfield const & getField() const { return m_field; }
 
-    void markDescendantsForDeletion()
+    //  returns the committed node with this id, or nullptr
+    qnode const * findNode(int id) const
     {
-        std::unordered_set<int> safeList;
+        return m_nodes.find(id);
+    }
 
-        for (auto it = m_nodeList.begin(); it != m_nodeList.end(); ++it)
-        {
-            bool del = false;
+    void getLineage(qnode const & node, std::vector<string> & lineage) const override
+    {
+        lineage.clear();
+        lineage.push_back(getTransformKey(node.transformId));
 
-            int idx = it->id;
-            while (1)
+        // walk up the parent links
+        int slot = m_nodes.findSlot(node.id);
+        int parentId = node.parentId;
+        while (parentId != 0)
+        {
+            slot = (slot < 0 ? m_nodes.findSlot(parentId) : m_nodes.getParentSlot(slot));
+            if (slot < 0)
             {
-                if (safeList.find(idx) != safeList.end())
-                {
-                    //safe = true;
-                    break;
-                }
-                if (m_markedForDeletion.find(idx) != m_markedForDeletion.end())
-                {
-                    del = true;
-                    break;
-                }
-                auto jt = findNode(idx);
-                if (jt->parentId == idx)
-                    break;
-                idx = jt->parentId;
+                cout << "Parent id not found:>" << parentId << endl;
+                return;
             }
+            auto const &parent = m_nodes.at(slot);
+            lineage.push_back(getTransformKey(parent.transformId));
+            parentId = parent.parentId;
+        }
+    }
 
-            if (del)
-            {
-                auto jt = it;
-                while (1)
-                {
-                    m_markedForDeletion.insert(jt->id);
-                    if (jt->parentId == jt->id)
-                        break;
-                    jt = findNode(jt->parentId);
-                }
-            }
-            else
+    //  With an owner field, returns the owners of the field cells under {rect}, at both resolutions.
+    //  Masks are shaved at their borders, so a rect on an outline may touch no owned cell; then the owners
+    //  of cells within a couple of cells of it are found, and kept if their polygons touch the rect.
+    //  A rect on the background finds nothing, without visiting the other nodes.
+    virtual void getNodesIntersecting(cv::Rect2f const &rect, std::vector<qnode> &nodes) const override
+    {
+        if (!m_owners.empty())
+        {
+            std::vector<int> ids;
+            getOwners(rect, 0, ids);
+            bool exact = !ids.empty();
+            if (!exact)
+                getOwners(rect, 2, ids);
+
+            for (int id : ids)
             {
-                auto jt = it;
-                while (1)
-                {
-                    safeList.insert(jt->id);
-                    if (jt->parentId == jt->id)
-                        break;
-                    jt = findNode(jt->parentId);
-                }
+                auto pNode = m_nodes.find(id);
+                if (pNode && (exact || isUnder(*pNode, rect)))
+                    nodes.push_back(*pNode);
             }
+            return;
         }
+
+        for (auto & node : m_nodes)
+        {
+            if (isUnder(node, rect))
+                nodes.push_back(node);
+        }
+    }
+
+private:
+    //  Appends the distinct owners of the field cells under {rect}, widened by {margin} cells, at both resolutions
+    void getOwners(cv::Rect2f const &rect, int margin, std::vector<int> &ids) const
+    {
+        std::vector<cv::Point2f> corners = { rect.tl(), rect.br() }, v;
+        cv::transform(corners, v, m_fieldTransform.get_minor<2, 3>(0, 0));
+        cv::Rect cells = cv::boundingRect(std::vector<cv::Point>(v.begin(), v.end()));
+        m_owners.getOwners(cv::Rect(cells.x - margin, cells.y - margin, cells.width + 2 * margin, cells.height + 2 * margin), ids);
+
+        if (!m_fineOwners.empty())
+        {
+            // refined cells as in getFieldPolygon
+            float f = (float)refineFactor;
+            for (auto &p : v)
+                p = p * f + cv::Point2f(0.5f * (f - 1), 0.5f * (f - 1));
+            cells = cv::boundingRect(std::vector<cv::Point>(v.begin(), v.end()));
+            m_fineOwners.getOwners(cv::Rect(cells.x - margin, cells.y - margin, cells.width + 2 * margin, cells.height + 2 * margin), ids);
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        }
+    }
+
+    //  true if {rect}'s corner is in the node's polygon, or one of its vertices is in {rect}
+    bool isUnder(qnode const &node, cv::Rect2f const &rect) const
+    {
+        std::vector<cv::Point2f> pts;
+        getPolyPoints(node, pts);
+
+        if (cv::pointPolygonTest(pts, rect.tl(), false) >= 0.0)
+            return true;
+
+        // this is not a proper intersection
+        for (auto const& pt : pts)
+        {
+            if (rect.contains(pt))
+                return true;
+        }
+        return false;
     }
 
-    //bool isAncestorMarkedForDeletion(int id)
-    //{
-    //    auto it = findNode(id);
-    //    while (it != m_nodeList.end())
-    //    {
-    //        if (m_markedForDeletion.find(it->id) != m_markedForDeletion.end())
-    //            return true;
-    //        if (it->parentId == it->id)
-    //            return false;
-    //        it = findNode(it->parentId);
-    //    }
-    //    // ??
-    //    return false;
-    //}
+public:
+    //  removes a node and all of its descendants, clearing them from the field.
+    //  a negative id removes only the oldest remaining node, leaving its children in place.
+    virtual int removeNode(int id) override
+    {
+        if (id < 0)
+        {
+            if (m_nodes.empty())
+                return 0;
+
+            auto const &node = *m_nodes.begin();
+            cout << " -- removing " << (node.id) << " from " << (node.parentId) << " remaining: " << m_nodes.size() << endl;
+            undrawNode(node);
+            m_nodes.remove(node.id);
+            return 1;
+        }
+
+        std::vector<int> removedSlots;
+        int removed = m_nodes.removeSubtree(id, &removedSlots);
+
+        for (int slot : removedSlots)
+        {
+            undrawNode(m_nodes.at(slot));
+        }
+
+        if (removed)
+            cout << " -- removed " << removed << " nodes from " << id << " remaining: " << m_nodes.size() << endl;
+
+        return removed;
+    }
 
     virtual void regrowAll() override
     {
-        for (auto & currentNode : m_nodeList)
+        for (auto & currentNode : m_nodes)
         {
-            // !TODO! this is duplicated code
-            // create a child node for each available transform.
-            // all child nodes are added to the queue, even if not viable.
-            for (auto const &t : transforms)
-            {
-                qnode child;
-                beget(currentNode, t, child);
-                nodeQueue.push(child);
-            }
+            pushChildren(currentNode);
         }
     }
 
@@ -550,10 +1070,12 @@ public:
     {
         canvas.clear();
 
-        for (auto & node : m_nodeList)
+        canvas.beginBatch();
+        for (auto & node : m_nodes)
         {
             drawNode(canvas, node);
         }
+        canvas.endBatch(lineThickness, lineColor);
     }
 
 };
@@ -664,7 +1186,7 @@ public:
         float r0 = 0.5f;
         float r1 = 1.0f;
         float growthFactor = pow(r1 / r0, 2.0f / steps);
-        polygon = { { {r0,0}, {r1,0}, {r1*growthFactor*cos(angle),r1*growthFactor*sin(angle)}, {r0*growthFactor*cos(angle),r0*growthFactor*sin(angle)} } };
+        polygon = { { {r0,0}, {r1,0}, {r1*growthFactor*std::cos(angle),r1*growthFactor*std::sin(angle)}, {r0*growthFactor*std::cos(angle),r0*growthFactor*std::sin(angle)} } };
 
         // override edge transforms
         transforms.clear();
@@ -794,17 +1316,22 @@ public:
     {
         // save the intersection field mask
         imagePath = imagePath.replace_extension("mask.png");
-        cv::imwrite(imagePath.string(), m_field);
+        if (m_field.empty())
+            return;     // analytic collision backend
+
+        cv::Mat1b fieldMask;
+        getFieldImage(fieldMask);
+        cv::imwrite(imagePath.string(), fieldMask);
     }
 
     void drawNode(qcanvas &canvas, qnode const &node) override
     {
         cv::Scalar color =
-            //(node.det() < 0) ? 255.0 * (cv::Scalar(1.0, 1.0, 1.0, 1.0) - node.color) : 
-            255.0 * node.color;
+            //(node.det() < 0) ? 255.0 * (cv::Scalar(1.0, 1.0, 1.0, 1.0) - node.getColor()) : 
+            255.0 * node.getColor();
 
         // todo
-        canvas.fillPoly(drawPolygon, node.globalTransform, 255.0 * node.color, lineThickness, lineColor);
+        canvas.fillPoly(drawPolygon, node.getTransform(), color, lineThickness, lineColor);
 
         // modify polygon that's drawn
         //pts[0].resize(4);
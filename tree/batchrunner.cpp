@@ -0,0 +1,252 @@
+//  Headless batch runner
+//  Grows each tree in a list of settings files to completion (or to a node/time budget)
+//  and writes the same PNG, SVG, settings and mask outputs as TreeDemo::save, without a GUI.
+//  --sinks picks the render outputs, so a sweep that only needs statistics or a node log can skip the rest.
+//
+//  Usage: thicket-batch [options] tree0001.settings.json [tree0002.settings.json ...]
+
+#include "SelfLimitingPolygonTree.h"
+#include "ReptileTree.h"
+#include "growthrun.h"
+#include <opencv2/core/core.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace fs = std::filesystem;
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+struct BatchOptions
+{
+    fs::path outputDir;                         // empty: next to each settings file
+    GrowthLimits limits;
+    cv::Size renderSize = cv::Size(2000, 1500);
+    float imagePadding = 0.1f;
+    std::vector<string> sinks = { "raster", "svg" };
+    qsvgSink::Encoding svgEncoding = qsvgSink::Encoding::POLYGONS;
+    int svgPrecision = 2;
+};
+
+
+static void showUsage()
+{
+    cout << "Usage: thicket-batch [options] settings.json...\n"
+        << "  -o DIR     output directory (default: next to each settings file)\n"
+        << "  -n NODES   stop after NODES nodes have been added\n"
+        << "  -t SECONDS stop after SECONDS of growth\n"
+        << "  -s WxH     render size (default 2000x1500)\n"
+        << "  -p PAD     image padding fraction (default 0.1)\n"
+        << "  -b N       nodes per batch (default 256; 1 for serial processing)\n"
+        << "  --sinks LIST\n"
+        << "             comma-separated outputs: raster, svg, binary (node log), null\n"
+        << "             (default raster,svg)\n"
+        << "  --no-svg   skip the SVG output\n"
+        << "  --svg-symbols N\n"
+        << "             write the SVG outline once and nodes as <use> transforms,\n"
+        << "             with N decimal places (default 2)\n";
+}
+
+
+//  "tree0001.settings.json" -> "tree0001"
+static string getBaseName(fs::path const &settingsPath)
+{
+    string name = settingsPath.filename().string();
+    string const suffix = ".settings.json";
+    if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+        return name.substr(0, name.size() - suffix.size());
+    return settingsPath.stem().string();
+}
+
+
+static int runSettingsFile(fs::path const &settingsPath, BatchOptions const &options, GrowthStats &stats)
+{
+    std::ifstream infile(settingsPath);
+    if (!infile)
+    {
+        cerr << "Unable to open " << settingsPath << endl;
+        return -1;
+    }
+
+    json j;
+    infile >> j;
+
+    auto pTree = qtree::createTreeFromJson(j);
+    if (!pTree)
+    {
+        cerr << "Unable to create tree from " << settingsPath << endl;
+        return -1;
+    }
+
+    pTree->create();
+    pTree->transformCounts.clear();
+
+    fs::path outputDir = (options.outputDir.empty() ? settingsPath.parent_path() : options.outputDir);
+    fs::path basePath = outputDir / getBaseName(settingsPath);
+
+    qcanvas canvas;
+    canvas.create(cv::Mat3b(options.renderSize));
+    canvas.clearSinks();
+    for (auto const &name : options.sinks)
+    {
+        if (name == "svg")
+            canvas.addSink(std::make_shared<qsvgSink>(options.svgEncoding, options.svgPrecision));
+        else
+            canvas.addSink(qrenderSink::createFromName(name, fs::path(basePath).concat(".nodes")));
+    }
+    canvas.clear();
+    canvas.setTransformToFit(pTree->getBoundingRect(), options.imagePadding);
+
+    profile::reset();
+
+    growTree(*pTree, &canvas, options.limits, stats);
+
+    pTree->saveOutputs(basePath, canvas);
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    BatchOptions options;
+    std::vector<fs::path> settingsPaths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if (arg == "-h" || arg == "--help")
+        {
+            showUsage();
+            return 0;
+        }
+        else if (arg == "-o" && hasValue)
+        {
+            options.outputDir = argv[++i];
+        }
+        else if (arg == "-n" && hasValue)
+        {
+            options.limits.maxNodes = std::atoll(argv[++i]);
+        }
+        else if (arg == "-t" && hasValue)
+        {
+            options.limits.maxSeconds = std::atof(argv[++i]);
+        }
+        else if (arg == "-s" && hasValue)
+        {
+            int w = 0, h = 0;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+            {
+                cerr << "Invalid render size: " << argv[i] << endl;
+                return 2;
+            }
+            options.renderSize = cv::Size(w, h);
+        }
+        else if (arg == "-p" && hasValue)
+        {
+            options.imagePadding = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "-b" && hasValue)
+        {
+            options.limits.batchSize = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--sinks" && hasValue)
+        {
+            options.sinks.clear();
+            std::stringstream ss(argv[++i]);
+            string sink;
+            while (std::getline(ss, sink, ','))
+                options.sinks.push_back(sink);
+        }
+        else if (arg == "--no-svg")
+        {
+            options.sinks.erase(std::remove(options.sinks.begin(), options.sinks.end(), "svg"), options.sinks.end());
+        }
+        else if (arg == "--svg-symbols" && hasValue)
+        {
+            options.svgEncoding = qsvgSink::Encoding::SYMBOLS;
+            options.svgPrecision = std::clamp(std::atoi(argv[++i]), 0, 9);
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            cerr << "Unknown option: " << arg << endl;
+            showUsage();
+            return 2;
+        }
+        else
+        {
+            settingsPaths.push_back(arg);
+        }
+    }
+
+    if (settingsPaths.empty())
+    {
+        showUsage();
+        return 2;
+    }
+
+    if (!options.outputDir.empty())
+    {
+        fs::create_directories(options.outputDir);
+    }
+
+    GrowthStats total;
+    int failures = 0;
+
+    for (auto const &settingsPath : settingsPaths)
+    {
+        GrowthStats stats;
+        try
+        {
+            if (runSettingsFile(settingsPath, options, stats) != 0)
+            {
+                ++failures;
+                continue;
+            }
+        }
+        catch (std::exception &ex)
+        {
+            cerr << settingsPath << ": " << ex.what() << endl;
+            ++failures;
+            continue;
+        }
+
+        cout << settingsPath.filename().string() << ": "
+            << stats.nodesAdded << " nodes, "
+            << stats.nodesProcessed << " candidates in "
+            << std::fixed << std::setprecision(3) << stats.seconds << "s ("
+            << std::setprecision(0) << stats.getNodesPerSecond() << " nodes/s, "
+            << stats.getCandidatesPerSecond() << " candidates/s), peak queue "
+            << stats.peakQueueSize << endl;
+        cout << std::defaultfloat << std::setprecision(6);
+
+        if (profile::isEnabled())
+        {
+            profile::report(cout);
+        }
+
+        total.nodesAdded += stats.nodesAdded;
+        total.nodesProcessed += stats.nodesProcessed;
+        total.seconds += stats.seconds;
+    }
+
+    cout << "Total: " << (settingsPaths.size() - failures) << " of " << settingsPaths.size() << " files, "
+        << total.nodesAdded << " nodes in " << total.seconds << "s ("
+        << (long long)total.getNodesPerSecond() << " nodes/s)" << endl;
+
+    return (failures ? 1 : 0);
+}
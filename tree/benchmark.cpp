@@ -0,0 +1,507 @@
+//  Growth benchmark
+//  Runs every registered qtree type with fixed random seeds to a fixed node count
+//  and writes throughput, peak queue depth and peak memory as JSON. Peak memory is per run where
+//  the platform can reset the high-water mark (Linux), and otherwise process-wide.
+//
+//  With -k, instead benchmarks the collision field kernels: grows each self-limiting tree, then times
+//  overlap tests and compositing of its queued candidates with OpenCV 8-bit image operations and with
+//  the bit field at each SIMD level the CPU supports.
+//
+//  Usage: thicket-benchmark [options] > results.json
+
+#include "SelfLimitingPolygonTree.h"
+#include "ReptileTree.h"
+#include "growthrun.h"
+#include "qbitkernels.h"
+#include <opencv2/core/core.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+struct BenchmarkOptions
+{
+    GrowthLimits limits;
+    std::vector<int> seeds = { 1, 2, 3 };
+    std::vector<string> classNames;             // empty: all registered types
+    QueueEngine queueEngine = QueueEngine::HEAP;
+    double queueBucketWidth = 0.0;
+    bool lazyChildren = false;
+    bool draw = true;
+    std::vector<string> sinks = { "raster" };   // render outputs when drawing
+    cv::Size renderSize = cv::Size(2000, 1500);
+    int kernelCandidates = 0;                   // > 0: kernel benchmark with this many candidates
+    int kernelRepeats = 5;
+};
+
+
+static void showUsage()
+{
+    cout << "Usage: thicket-benchmark [options]\n"
+        << "  -n NODES   nodes to grow per run (default 20000)\n"
+        << "  -r SEEDS   comma-separated random seeds (default 1,2,3)\n"
+        << "  -c CLASS   benchmark only this tree class; may be repeated\n"
+        << "  -b N       nodes per batch (default 256; 1 for serial processing)\n"
+        << "  -q ENGINE  node queue engine: heap or calendar (default heap)\n"
+        << "  -w WIDTH   calendar queue bucket width (default: from gestations)\n"
+        << "  -l         lazy child materialization\n"
+        << "  -s WxH     render size (default 2000x1500)\n"
+        << "  -x         don't draw nodes\n"
+        << "  -d SINKS   comma-separated render sinks to draw to: raster, svg, binary, null (default raster)\n"
+        << "  -k N       benchmark field kernels on N queued candidates per run, instead of growth\n";
+}
+
+
+#ifdef __linux__
+//  Value of a "Key:  N kB" line of /proc/self/status, in bytes, or -1
+static long long readProcStatus(char const *key)
+{
+    std::ifstream status("/proc/self/status");
+    string line;
+    size_t keyLength = std::strlen(key);
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, keyLength, key) == 0 && line.size() > keyLength && line[keyLength] == ':')
+            return std::atoll(line.c_str() + keyLength + 1) * 1024;
+    }
+    return -1;
+}
+#endif
+
+
+//  Resets the peak resident memory to the current resident memory, where the platform allows it,
+//  so getPeakMemoryUsage() measures one run. Returns the current resident memory in bytes,
+//  or -1 if the peak can't be reset.
+static long long resetPeakMemoryUsage()
+{
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.close();
+    if (!clearRefs.fail())
+        return readProcStatus("VmRSS");
+#endif
+    return -1;
+}
+
+
+//  Peak resident memory since resetPeakMemoryUsage(), or since the process started, in bytes
+static long long getPeakMemoryUsage()
+{
+#ifdef __linux__
+    long long peak = readProcStatus("VmHWM");
+    if (peak >= 0)
+        return peak;
+#endif
+
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (long long)pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+        return (long long)usage.ru_maxrss;          // bytes
+#else
+        return (long long)usage.ru_maxrss * 1024;   // kilobytes
+#endif
+    }
+    return 0;
+#endif
+}
+
+
+static json runBenchmark(string const &className, int seed, BenchmarkOptions const &options)
+{
+    auto pTree = qtree::factory().at(className)();
+    pTree->setRandomSeed(seed);
+
+    pTree->queueEngine = options.queueEngine;
+    pTree->queueBucketWidth = options.queueBucketWidth;
+    pTree->lazyChildren = options.lazyChildren;
+
+    pTree->create();
+    pTree->transformCounts.clear();
+
+    qcanvas canvas;
+    if (options.draw)
+    {
+        canvas.create(cv::Mat3b(options.renderSize));
+        canvas.setSinks(options.sinks, fs::temp_directory_path() / "thicket-benchmark.nodes");
+        canvas.clear();
+        canvas.setTransformToFit(pTree->getBoundingRect(), 0.1f);
+    }
+
+    profile::reset();
+
+    long long startMemory = resetPeakMemoryUsage();
+
+    GrowthStats stats;
+    growTree(*pTree, (options.draw ? &canvas : nullptr), options.limits, stats);
+
+    json result = json{
+        { "class", className },
+        { "seed", seed },
+        { "nodes", stats.nodesAdded },
+        { "candidates", stats.nodesProcessed },
+        { "seconds", stats.seconds },
+        { "nodesPerSecond", stats.getNodesPerSecond() },
+        { "candidatesPerSecond", stats.getCandidatesPerSecond() },
+        { "peakQueueSize", stats.peakQueueSize },
+        { "complete", pTree->isQueueEmpty() }
+    };
+
+    if (startMemory >= 0)
+    {
+        // high-water mark of this run, which includes whatever the process held when it started
+        result["peakMemoryBytes"] = getPeakMemoryUsage();
+        result["startMemoryBytes"] = startMemory;
+    }
+    else
+    {
+        // the peak can't be reset here, so this is the high-water mark of all runs so far
+        result["processPeakMemoryBytes"] = getPeakMemoryUsage();
+    }
+
+    if (options.draw)
+    {
+        result["displayListBytes"] = canvas.getDisplayList().getMemorySize();
+    }
+
+    if (auto pSelfLimiting = dynamic_cast<SelfLimitingPolygonTree const *>(pTree.get()))
+    {
+        auto cacheStats = pSelfLimiting->getStampCacheStats();
+        result["stampCache"] = json{
+            { "hits", cacheStats.hits },
+            { "misses", cacheStats.misses },
+            { "evictions", cacheStats.evictions },
+            { "hitRate", cacheStats.getHitRate() },
+            { "bytes", cacheStats.bytes }
+        };
+        result["fieldBytes"] = pSelfLimiting->getFieldMemorySize();
+    }
+
+    if (profile::isEnabled())
+    {
+        result["profile"] = profile::toJson();
+    }
+
+    return result;
+}
+
+
+#pragma region Kernel benchmark
+
+//  Best time of {repeats} calls of {fn}, after {setup} for each
+template<typename _Setup, typename _Fn>
+static double timeBest(int repeats, _Setup setup, _Fn fn)
+{
+    double best = 0.0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        setup();
+        auto startTime = std::chrono::steady_clock::now();
+        fn();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+
+static json runKernelBenchmark(string const &className, int seed, BenchmarkOptions const &options)
+{
+    auto pTree = qtree::factory().at(className)();
+    auto pSelfLimiting = dynamic_cast<SelfLimitingPolygonTree *>(pTree.get());
+    if (!pSelfLimiting)
+        return json();
+
+    pTree->setRandomSeed(seed);
+    pTree->queueEngine = options.queueEngine;
+    pTree->queueBucketWidth = options.queueBucketWidth;
+    pTree->lazyChildren = options.lazyChildren;
+    pTree->create();
+
+    // the analytic backend has no field
+    if (pSelfLimiting->getField().empty())
+        return json();
+
+    GrowthStats stats;
+    growTree(*pTree, nullptr, options.limits, stats);
+
+    // rasterize queued candidates against the grown field
+    std::vector<qcandidate> candidates;
+    std::vector<cv::Mat1b> masks;
+    long long cells = 0;
+    while ((int)candidates.size() < options.kernelCandidates && !pTree->isQueueEmpty())
+    {
+        qcandidate candidate(pTree->peekNode());
+        pTree->popNode();
+        if (!pSelfLimiting->rasterize(candidate) || candidate.fieldMask.empty())
+            continue;
+
+        masks.emplace_back();
+        candidate.fieldMask.toMat(masks.back());
+        cells += candidate.fieldMask.rect.area();
+        candidates.push_back(std::move(candidate));
+    }
+
+    qbitfield const &field = pSelfLimiting->getField();
+    cv::Mat1b fieldImage;
+    field.toMat(fieldImage);
+
+    int repeats = options.kernelRepeats;
+    size_t n = candidates.size();
+
+    // OpenCV on 8-bit images
+    long long referenceOverlap = 0;
+    cv::Mat1b scratch;
+    double cvOverlap = timeBest(repeats, [&] { referenceOverlap = 0; }, [&]
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            cv::bitwise_and(fieldImage(candidates[i].fieldMask.rect), masks[i], scratch);
+            referenceOverlap += cv::countNonZero(scratch);
+        }
+    });
+
+    cv::Mat1b referenceImage;
+    double cvComposite = timeBest(repeats, [&] { fieldImage.copyTo(referenceImage); }, [&]
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            cv::Mat1b roi = referenceImage(candidates[i].fieldMask.rect);
+            cv::bitwise_or(roi, masks[i], roi);
+        }
+    });
+
+    json result = json{
+        { "class", className },
+        { "seed", seed },
+        { "nodes", stats.nodesAdded },
+        { "candidates", n },
+        { "maskCells", cells },
+        { "opencv", json{
+            { "overlapSeconds", cvOverlap },
+            { "compositeSeconds", cvComposite } } }
+    };
+
+    // bit field at each supported level
+    auto bestLevel = qbitKernels::getBestLevel();
+    json levels;
+    for (int level = 0; level <= (int)bestLevel; ++level)
+    {
+        qbitKernels::setLevel((qbitKernels::Level)level);
+
+        int blocked = 0;
+        double intersectSeconds = timeBest(repeats, [&] { blocked = 0; }, [&]
+        {
+            for (auto const &candidate : candidates)
+                blocked += field.intersects(candidate.fieldMask);
+        });
+
+        long long overlap = 0;
+        double countSeconds = timeBest(repeats, [&] { overlap = 0; }, [&]
+        {
+            for (auto const &candidate : candidates)
+                overlap += field.countOverlap(candidate.fieldMask);
+        });
+
+        qbitfield composited;
+        composited.create(field.size());
+        double compositeSeconds = timeBest(repeats, [&] { composited.fromMat(fieldImage); }, [&]
+        {
+            for (auto const &candidate : candidates)
+                composited.composite(candidate.fieldMask);
+        });
+
+        cv::Mat1b compositedImage;
+        composited.toMat(compositedImage);
+
+        levels[qbitKernels::getLevelName((qbitKernels::Level)level)] = json{
+            { "intersectsSeconds", intersectSeconds },
+            { "countOverlapSeconds", countSeconds },
+            { "compositeSeconds", compositeSeconds },
+            { "blocked", blocked },
+            // results agree with OpenCV
+            { "match", (overlap == referenceOverlap && cv::countNonZero(compositedImage != referenceImage) == 0) }
+        };
+    }
+    qbitKernels::setLevel(bestLevel);
+
+    result["levels"] = levels;
+    return result;
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    options.limits.maxNodes = 20000;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if (arg == "-h" || arg == "--help")
+        {
+            showUsage();
+            return 0;
+        }
+        else if (arg == "-n" && hasValue)
+        {
+            options.limits.maxNodes = std::atoll(argv[++i]);
+        }
+        else if (arg == "-r" && hasValue)
+        {
+            options.seeds.clear();
+            std::stringstream ss(argv[++i]);
+            string seed;
+            while (std::getline(ss, seed, ','))
+                options.seeds.push_back(std::atoi(seed.c_str()));
+        }
+        else if (arg == "-c" && hasValue)
+        {
+            options.classNames.push_back(argv[++i]);
+        }
+        else if (arg == "-b" && hasValue)
+        {
+            options.limits.batchSize = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "-q" && hasValue)
+        {
+            options.queueEngine = (string(argv[++i]) == "calendar" ? QueueEngine::CALENDAR : QueueEngine::HEAP);
+        }
+        else if (arg == "-w" && hasValue)
+        {
+            options.queueBucketWidth = std::atof(argv[++i]);
+        }
+        else if (arg == "-l")
+        {
+            options.lazyChildren = true;
+        }
+        else if (arg == "-s" && hasValue)
+        {
+            int w = 0, h = 0;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+            {
+                cerr << "Invalid render size: " << argv[i] << endl;
+                return 2;
+            }
+            options.renderSize = cv::Size(w, h);
+        }
+        else if (arg == "-x")
+        {
+            options.draw = false;
+        }
+        else if (arg == "-d" && hasValue)
+        {
+            options.sinks.clear();
+            std::stringstream ss(argv[++i]);
+            string sink;
+            while (std::getline(ss, sink, ','))
+                options.sinks.push_back(sink);
+        }
+        else if (arg == "-k" && hasValue)
+        {
+            options.kernelCandidates = std::max(1, std::atoi(argv[++i]));
+        }
+        else
+        {
+            cerr << "Unknown option: " << arg << endl;
+            showUsage();
+            return 2;
+        }
+    }
+
+    if (options.classNames.empty())
+    {
+        for (auto const &entry : qtree::factory())
+            options.classNames.push_back(entry.first);
+    }
+
+    json results = json::array();
+
+    for (auto const &className : options.classNames)
+    {
+        if (qtree::factory().find(className) == qtree::factory().end())
+        {
+            cerr << "Class not registered: '" << className << "'" << endl;
+            return 2;
+        }
+
+        for (int seed : options.seeds)
+        {
+            if (options.kernelCandidates > 0)
+            {
+                auto result = runKernelBenchmark(className, seed, options);
+                if (result.is_null())
+                    break;      // no collision field
+
+                results.push_back(result);
+                cerr << std::setw(24) << std::left << className << " seed " << std::setw(4) << seed << ": "
+                    << result["candidates"] << " candidates" << endl;
+                continue;
+            }
+
+            auto result = runBenchmark(className, seed, options);
+            results.push_back(result);
+
+            // progress to stderr, so stdout stays machine-readable
+            cerr << std::setw(24) << std::left << className << " seed " << std::setw(4) << seed << ": "
+                << result["nodes"] << " nodes, " << (long long)result["nodesPerSecond"].get<double>() << " nodes/s" << endl;
+        }
+    }
+
+    json j;
+    j["settings"] = json{
+        { "nodes", options.limits.maxNodes },
+        { "batchSize", options.limits.batchSize },
+        { "queue", json{
+            { "engine", (options.queueEngine == QueueEngine::CALENDAR ? "calendar" : "heap") },
+            { "bucketWidth", options.queueBucketWidth },
+            { "lazy", options.lazyChildren } } },
+        { "draw", options.draw },
+        { "sinks", options.sinks },
+        { "renderSize", { options.renderSize.width, options.renderSize.height } }
+    };
+    if (options.kernelCandidates > 0)
+    {
+        j["settings"]["kernels"] = json{
+            { "candidates", options.kernelCandidates },
+            { "repeats", options.kernelRepeats },
+            { "bestLevel", qbitKernels::getLevelName(qbitKernels::getBestLevel()) }
+        };
+    }
+    j["results"] = results;
+
+    cout << std::setw(4) << j << endl;
+
+    return 0;
+}
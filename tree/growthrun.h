@@ -0,0 +1,69 @@
+#pragma once
+
+#include "tree.h"
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+
+//  Headless growth loop shared by the batch runner and the benchmark
+
+
+struct GrowthLimits
+{
+    long long maxNodes = 0;                     // 0: no limit
+    double maxSeconds = 0.0;                    // 0: no limit
+    int batchSize = 256;                        // nodes per qtree::processBatch call; 1 for serial
+};
+
+
+struct GrowthStats
+{
+    long long nodesAdded = 0;
+    long long nodesProcessed = 0;               // candidates popped, viable or not
+    size_t peakQueueSize = 0;
+    double seconds = 0.0;
+
+    double getNodesPerSecond() const { return nodesAdded / std::max(seconds, 1e-9); }
+    double getCandidatesPerSecond() const { return nodesProcessed / std::max(seconds, 1e-9); }
+};
+
+
+//  Grows {tree} from its current queue until the queue is empty or a limit is reached.
+//  Committed nodes are drawn on {pCanvas}, if provided.
+inline void growTree(qtree &tree, qcanvas *pCanvas, GrowthLimits const &limits, GrowthStats &stats)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<qnode> committed;
+
+    while (!tree.isQueueEmpty())
+    {
+        if (limits.maxNodes > 0 && stats.nodesAdded >= limits.maxNodes)
+            break;
+        if (limits.maxSeconds > 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() >= limits.maxSeconds)
+            break;
+
+        int batchSize = std::max(1, limits.batchSize);
+        if (limits.maxNodes > 0)
+            batchSize = (int)std::min<long long>(batchSize, limits.maxNodes - stats.nodesAdded);
+
+        size_t queueSize = tree.getQueueSize();
+        stats.peakQueueSize = std::max(stats.peakQueueSize, queueSize);
+
+        committed.clear();
+        int popped = 0;
+        stats.nodesAdded += tree.processBatch(batchSize, &committed, &popped);
+        stats.nodesProcessed += popped;
+
+        if (pCanvas && pCanvas->isDrawing())
+        {
+            for (auto const &node : committed)
+            {
+                tree.drawNode(*pCanvas, node);
+            }
+        }
+    }
+
+    stats.peakQueueSize = std::max(stats.peakQueueSize, tree.getQueueSize());
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
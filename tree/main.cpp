@@ -151,7 +151,7 @@ int main(int argc, char** argv)
             std::this_thread::sleep_for(0.03s);
         }
 
-        if (g_treeDemo.getTree()->nodeQueue.empty())
+        if (g_treeDemo.getTree()->isQueueEmpty())
         {
             g_treeDemo.showReport(0.0);
             cout << "Run complete.\n";
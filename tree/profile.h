@@ -0,0 +1,137 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+
+
+//  Hot-path phase counters and timers
+//  Compiled in only when THICKET_PROFILE is defined; otherwise PROFILE_SCOPE expands to nothing.
+//  Counters are process-wide and safe to update from the batch worker threads.
+//  Phase times are inclusive: beget includes the color transform it applies.
+
+namespace profile
+{
+    enum class Phase
+    {
+        QueuePop,
+        Beget,
+        Rasterize,
+        Collision,
+        Composite,
+        FillPolyRaster,
+        FillPolySvg,
+        ColorApply,
+        COUNT
+    };
+
+    inline char const * getPhaseName(Phase phase)
+    {
+        static char const * const names[] = {
+            "queuePop",
+            "beget",
+            "rasterize",
+            "collision",
+            "composite",
+            "fillPolyRaster",
+            "fillPolySvg",
+            "colorApply"
+        };
+        return names[(int)phase];
+    }
+
+    struct Counter
+    {
+        std::atomic<long long> calls{ 0 };
+        std::atomic<long long> nanoseconds{ 0 };
+    };
+
+    inline Counter * getCounters()
+    {
+        static Counter counters[(int)Phase::COUNT];
+        return counters;
+    }
+
+    inline constexpr bool isEnabled()
+    {
+#ifdef THICKET_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    inline void reset()
+    {
+        for (int i = 0; i < (int)Phase::COUNT; ++i)
+        {
+            getCounters()[i].calls = 0;
+            getCounters()[i].nanoseconds = 0;
+        }
+    }
+
+    //  Adds the lifetime of this object to a phase
+    class ScopedTimer
+    {
+        Counter &m_counter;
+        std::chrono::steady_clock::time_point m_start;
+
+    public:
+        ScopedTimer(Phase phase) : m_counter(getCounters()[(int)phase]), m_start(std::chrono::steady_clock::now()) { }
+
+        ~ScopedTimer()
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+            m_counter.calls.fetch_add(1, std::memory_order_relaxed);
+            m_counter.nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+        }
+    };
+
+    //  Prints a breakdown table: calls, total ms and mean ns per call for each phase
+    inline void report(std::ostream &os)
+    {
+        auto flags = os.flags();
+
+        os << "| " << std::left << std::setw(16) << "phase"
+            << std::right << std::setw(12) << "calls"
+            << std::setw(12) << "ms"
+            << std::setw(10) << "ns/call" << "\n";
+
+        for (int i = 0; i < (int)Phase::COUNT; ++i)
+        {
+            long long calls = getCounters()[i].calls;
+            long long ns = getCounters()[i].nanoseconds;
+            os << "| " << std::left << std::setw(16) << getPhaseName((Phase)i)
+                << std::right << std::setw(12) << calls
+                << std::setw(12) << ns / 1000000
+                << std::setw(10) << (calls ? ns / calls : 0) << "\n";
+        }
+        os.flags(flags);
+        os.flush();
+    }
+
+    inline nlohmann::json toJson()
+    {
+        nlohmann::json j = nlohmann::json::object();
+        for (int i = 0; i < (int)Phase::COUNT; ++i)
+        {
+            j[getPhaseName((Phase)i)] = nlohmann::json{
+                { "calls", getCounters()[i].calls.load() },
+                { "nanoseconds", getCounters()[i].nanoseconds.load() }
+            };
+        }
+        return j;
+    }
+}
+
+
+#define PROFILE_CONCAT_(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef THICKET_PROFILE
+#define PROFILE_SCOPE(PHASE) profile::ScopedTimer PROFILE_CONCAT(profileTimer_, __LINE__)(profile::Phase::PHASE)
+#else
+#define PROFILE_SCOPE(PHASE)
+#endif
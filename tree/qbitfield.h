@@ -0,0 +1,454 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <bit>
+#include <cassert>
+#include "qbitkernels.h"
+
+
+//  Bit-packed occupancy
+//  One bit per cell, 64 cells per word, least significant bit leftmost. Rows are padded to whole words.
+//  Masks are packed on the field's word grid, so compositing and overlap tests are word-wide
+//  AND/OR with no shifting. Conversion to 8-bit images is only for export and import.
+//  Masks store each word column contiguously, as tiles do, so a mask column against a tile is a
+//  single run of words for the vectorized kernels in qbitkernels.h.
+//
+//  The field is stored sparsely, in 64x64-cell tiles of one word per row. A tile is allocated when
+//  a cell in it is first set and released when its last cell is cleared, so memory tracks the
+//  occupied area rather than the domain.
+//
+//  The field also keeps an occupancy pyramid: set-cell counts for each tile and for 8x8-tile
+//  superblocks, updated incrementally by composite() and erase(). Overlap tests skip empty tiles
+//  outright and test only the mask over full tiles, so only mixed tiles are compared word by word.
+//
+//  Each tile has a version, incremented whenever its cells change, so a caller can tell whether the
+//  field under a rect changed since it was tested. composite() may be called from several threads at
+//  once for masks covering disjoint tiles.
+
+
+//  A rectangular packed mask positioned in field coordinates
+class qbitmask
+{
+public:
+    cv::Rect rect;                  // in field coordinates
+    int firstWord = 0;              // field word column of the first word in each row
+    int stride = 0;                 // words per row
+    std::vector<uint64_t> words;    // {stride} columns of rect.height words
+
+    bool empty() const { return rect.area() == 0; }
+
+    //  Clears the mask and positions it at {rect_}
+    void create(cv::Rect const &rect_)
+    {
+        rect = rect_;
+        firstWord = (rect.x >> 6);
+        stride = (rect.width > 0 ? ((rect.x + rect.width - 1) >> 6) - firstWord + 1 : 0);
+        words.assign((size_t)stride * rect.height, 0);
+    }
+
+    //  Bit index of the mask's left edge within its first word
+    int getBitOffset() const { return rect.x - (firstWord << 6); }
+
+    uint64_t * getColumn(int i) { return &words[(size_t)i * rect.height]; }
+    uint64_t const * getColumn(int i) const { return &words[(size_t)i * rect.height]; }
+
+    uint64_t & getWord(int y, int i) { return words[(size_t)i * rect.height + y]; }
+    uint64_t getWord(int y, int i) const { return words[(size_t)i * rect.height + y]; }
+
+    //  Sets cells [x0, x1] of row {y}, in mask coordinates
+    void setSpan(int y, int x0, int x1)
+    {
+        int b0 = getBitOffset() + x0, b1 = getBitOffset() + x1;
+        int w0 = (b0 >> 6), w1 = (b1 >> 6);
+        uint64_t first = ~uint64_t(0) << (b0 & 63);
+        uint64_t last = ~uint64_t(0) >> (63 - (b1 & 63));
+        if (w0 == w1)
+        {
+            getWord(y, w0) |= (first & last);
+            return;
+        }
+        getWord(y, w0) |= first;
+        for (int i = w0 + 1; i < w1; ++i)
+            getWord(y, i) = ~uint64_t(0);
+        getWord(y, w1) |= last;
+    }
+
+    //  Clears cell {x} of row {y}, in mask coordinates
+    void reset(int y, int x)
+    {
+        int bit = getBitOffset() + x;
+        getWord(y, bit >> 6) &= ~(uint64_t(1) << (bit & 63));
+    }
+
+    //  Packs an 8-bit mask drawn at {rect_}: nonzero cells are set
+    void pack(cv::Rect const &rect_, cv::Mat1b const &mask)
+    {
+        assert(mask.rows == rect_.height && mask.cols == rect_.width);
+
+        create(rect_);
+
+        int bitOffset = getBitOffset();
+        for (int y = 0; y < rect.height; ++y)
+        {
+            uint8_t const *src = mask.ptr<uint8_t>(y);
+            for (int x = 0; x < rect.width; ++x)
+            {
+                if (src[x])
+                {
+                    int bit = bitOffset + x;
+                    getWord(y, bit >> 6) |= (uint64_t(1) << (bit & 63));
+                }
+            }
+        }
+    }
+
+    //  8-bit image of the mask: 255 where set, 0 elsewhere
+    void toMat(cv::Mat1b &image) const
+    {
+        image.create(rect.height, rect.width);
+        int bitOffset = getBitOffset();
+        for (int y = 0; y < rect.height; ++y)
+        {
+            uint8_t *dst = image.ptr<uint8_t>(y);
+            for (int x = 0; x < rect.width; ++x)
+            {
+                int bit = bitOffset + x;
+                dst[x] = (((getWord(y, bit >> 6) >> (bit & 63)) & 1) ? 255 : 0);
+            }
+        }
+    }
+};
+
+
+class qbitfield
+{
+public:
+    enum class Occupancy { EMPTY, MIXED, FULL };
+
+    static const int BLOCK_SHIFT = 6;           // tiles are one word wide and 64 rows high
+    static const int SUPERBLOCK_SHIFT = 3;      // superblocks are 8x8 tiles
+
+private:
+    struct Tile
+    {
+        uint64_t rows[1 << BLOCK_SHIFT] = {};
+    };
+
+    int m_rows = 0;
+    int m_cols = 0;
+    int m_stride = 0;               // words per row, and tiles per tile row
+    int m_blockRows = 0;            // tile rows
+    std::vector<std::unique_ptr<Tile> > m_tiles;
+    std::vector<uint32_t> m_tileVersions;
+    std::atomic<size_t> m_tileCount{ 0 };
+
+    // occupancy pyramid: set cells per tile and per superblock
+    // superblocks are shared by neighboring tiles, so their counts are atomic
+    int m_superStride = 0;
+    int m_superRows = 0;
+    std::vector<int> m_blockCounts;
+    std::vector<std::atomic<int> > m_superblockCounts;
+
+public:
+    void create(cv::Size size)
+    {
+        m_rows = size.height;
+        m_cols = size.width;
+        m_stride = (m_cols + 63) >> 6;
+        m_blockRows = (m_rows + (1 << BLOCK_SHIFT) - 1) >> BLOCK_SHIFT;
+        m_superStride = (m_stride + (1 << SUPERBLOCK_SHIFT) - 1) >> SUPERBLOCK_SHIFT;
+        m_superRows = (m_blockRows + (1 << SUPERBLOCK_SHIFT) - 1) >> SUPERBLOCK_SHIFT;
+
+        m_tiles.clear();
+        m_tiles.resize((size_t)m_stride * m_blockRows);
+        m_tileVersions.assign((size_t)m_stride * m_blockRows, 0);
+        m_tileCount = 0;
+        m_blockCounts.assign((size_t)m_stride * m_blockRows, 0);
+        m_superblockCounts = std::vector<std::atomic<int> >((size_t)m_superStride * m_superRows);
+    }
+
+    void clear()
+    {
+        for (auto &tile : m_tiles)
+            tile.reset();
+        m_tileCount = 0;
+        std::fill(m_blockCounts.begin(), m_blockCounts.end(), 0);
+        for (auto &count : m_superblockCounts)
+            count = 0;
+
+        // versions keep counting, so clearing is seen as a change
+        for (auto &version : m_tileVersions)
+            version++;
+    }
+
+    int rows() const { return m_rows; }
+    int cols() const { return m_cols; }
+    cv::Size size() const { return cv::Size(m_cols, m_rows); }
+    bool empty() const { return (m_rows == 0 || m_cols == 0); }
+
+    size_t getTileCount() const { return m_tileCount; }
+
+    size_t getMemorySize() const
+    {
+        return m_tileCount * sizeof(Tile) + m_tiles.size() * (sizeof(m_tiles[0]) + sizeof(uint32_t))
+            + (m_blockCounts.size() + m_superblockCounts.size()) * sizeof(int);
+    }
+
+    //  Tiles covering {rect}, in tile coordinates: x in word columns, y in tile rows
+    static cv::Rect getTileRect(cv::Rect const &rect)
+    {
+        if (rect.area() == 0)
+            return cv::Rect();
+        int bx0 = (rect.x >> 6), bx1 = ((rect.x + rect.width - 1) >> 6);
+        int by0 = (rect.y >> BLOCK_SHIFT), by1 = ((rect.y + rect.height - 1) >> BLOCK_SHIFT);
+        return cv::Rect(bx0, by0, bx1 - bx0 + 1, by1 - by0 + 1);
+    }
+
+    //  Combined version of the tiles covering {rect}. Versions only increase, so an unchanged value
+    //  means no cell under {rect} has changed.
+    uint64_t getVersion(cv::Rect const &rect) const
+    {
+        cv::Rect tiles = getTileRect(rect);
+        uint64_t version = 0;
+        for (int by = tiles.y; by < tiles.y + tiles.height; ++by)
+            for (int bx = tiles.x; bx < tiles.x + tiles.width; ++bx)
+                version += m_tileVersions[(size_t)by * m_stride + bx];
+        return version;
+    }
+
+    bool get(int x, int y) const
+    {
+        Tile const *tile = getTile(x >> 6, y >> BLOCK_SHIFT);
+        return tile && ((tile->rows[y & 63] >> (x & 63)) & 1);
+    }
+
+    //  Word column {bx} of row {y}
+    uint64_t getWord(int y, int bx) const
+    {
+        Tile const *tile = getTile(bx, y >> BLOCK_SHIFT);
+        return (tile ? tile->rows[y & 63] : 0);
+    }
+
+    //  Occupancy of the tile at word column {bx}, tile row {by}
+    Occupancy getBlockOccupancy(int bx, int by) const
+    {
+        int sx = (bx >> SUPERBLOCK_SHIFT), sy = (by >> SUPERBLOCK_SHIFT);
+        int count = m_superblockCounts[(size_t)sy * m_superStride + sx].load(std::memory_order_relaxed);
+        if (count == 0)
+            return Occupancy::EMPTY;
+        if (count == getCapacity(sx << SUPERBLOCK_SHIFT, sy << SUPERBLOCK_SHIFT, 1 << SUPERBLOCK_SHIFT))
+            return Occupancy::FULL;
+
+        count = m_blockCounts[(size_t)by * m_stride + bx];
+        if (count == 0)
+            return Occupancy::EMPTY;
+        if (count == getCapacity(bx, by, 1))
+            return Occupancy::FULL;
+        return Occupancy::MIXED;
+    }
+
+    //  true if any cell of {mask} is set in the field
+    bool intersects(qbitmask const &mask) const
+    {
+        auto const &kernels = qbitKernels::get();
+        bool found = false;
+        forEachBlock(mask, [&](Occupancy occupancy, uint64_t const *src, uint64_t const *dst, int n)
+        {
+            found = (occupancy == Occupancy::FULL ? kernels.any(src, n) : kernels.anyAnd(src, dst, n));
+            return !found;
+        });
+        return found;
+    }
+
+    //  true if any cell of row {y} of {mask} is set in the field
+    bool intersectsRow(qbitmask const &mask, int y) const
+    {
+        int by = ((mask.rect.y + y) >> BLOCK_SHIFT);
+        for (int i = 0; i < mask.stride; ++i)
+        {
+            uint64_t bits = mask.getWord(y, i);
+            if (!bits)
+                continue;
+            switch (getBlockOccupancy(mask.firstWord + i, by))
+            {
+            case Occupancy::EMPTY:
+                break;
+            case Occupancy::FULL:
+                return true;
+            default:
+                if (getTile(mask.firstWord + i, by)->rows[(mask.rect.y + y) & 63] & bits)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    //  Number of cells of {mask} set in the field
+    long long countOverlap(qbitmask const &mask) const
+    {
+        auto const &kernels = qbitKernels::get();
+        long long count = 0;
+        forEachBlock(mask, [&](Occupancy occupancy, uint64_t const *src, uint64_t const *dst, int n)
+        {
+            // over a full tile, every mask cell counts: popcount(src & src)
+            count += kernels.countAnd(src, (occupancy == Occupancy::FULL ? src : dst), n);
+            return true;
+        });
+        return count;
+    }
+
+    //  Sets the cells of {mask}, allocating tiles as needed
+    void composite(qbitmask const &mask)
+    {
+        auto const &kernels = qbitKernels::get();
+        forEachSlice(mask, [&](int bx, int by, uint64_t const *src, int offset, int n)
+        {
+            if (!kernels.any(src, n))
+                return;
+
+            auto &tile = m_tiles[(size_t)by * m_stride + bx];
+            if (!tile)
+            {
+                tile.reset(new Tile);
+                m_tileCount++;
+            }
+
+            int added = kernels.orCount(tile->rows + offset, src, n);
+            if (added)
+                updateCounts(bx, by, added);
+        });
+    }
+
+    //  Clears the cells of {mask}, releasing tiles that become empty
+    void erase(qbitmask const &mask)
+    {
+        auto const &kernels = qbitKernels::get();
+        forEachSlice(mask, [&](int bx, int by, uint64_t const *src, int offset, int n)
+        {
+            size_t index = (size_t)by * m_stride + bx;
+            auto &tile = m_tiles[index];
+            if (!tile)
+                return;
+
+            int removed = kernels.andNotCount(tile->rows + offset, src, n);
+            if (removed)
+            {
+                updateCounts(bx, by, -removed);
+                if (m_blockCounts[index] == 0)
+                {
+                    tile.reset();
+                    m_tileCount--;
+                }
+            }
+        });
+    }
+
+    //  8-bit image of the field: 255 where set, 0 elsewhere
+    void toMat(cv::Mat1b &image) const
+    {
+        image.create(m_rows, m_cols);
+        for (int y = 0; y < m_rows; ++y)
+        {
+            uint8_t *dst = image.ptr<uint8_t>(y);
+            for (int x = 0; x < m_cols; ++x)
+                dst[x] = (get(x, y) ? 255 : 0);
+        }
+    }
+
+    //  Sets the field from an 8-bit image of the same size: nonzero pixels are set
+    void fromMat(cv::Mat1b const &image)
+    {
+        assert(image.rows == m_rows && image.cols == m_cols);
+
+        clear();
+
+        // one row at a time, as a full-width mask
+        qbitmask row;
+        for (int y = 0; y < m_rows; ++y)
+        {
+            row.create(cv::Rect(0, y, m_cols, 1));
+            uint8_t const *src = image.ptr<uint8_t>(y);
+            for (int x = 0; x < m_cols; ++x)
+            {
+                if (src[x])
+                    row.getWord(0, x >> 6) |= (uint64_t(1) << (x & 63));
+            }
+            composite(row);
+        }
+    }
+
+private:
+    Tile const * getTile(int bx, int by) const
+    {
+        return m_tiles[(size_t)by * m_stride + bx].get();
+    }
+
+    //  Number of cells in the {n}x{n}-tile square at tile ({bx}, {by}), clipped to the field
+    int getCapacity(int bx, int by, int n) const
+    {
+        int width = std::min(m_cols, (bx + n) << 6) - (bx << 6);
+        int height = std::min(m_rows, (by + n) << BLOCK_SHIFT) - (by << BLOCK_SHIFT);
+        return width * height;
+    }
+
+    void updateCounts(int bx, int by, int delta)
+    {
+        size_t index = (size_t)by * m_stride + bx;
+        m_blockCounts[index] += delta;
+        m_tileVersions[index]++;
+        m_superblockCounts[(size_t)(by >> SUPERBLOCK_SHIFT) * m_superStride + (bx >> SUPERBLOCK_SHIFT)].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    //  Calls {fn(bx, by, src, offset, n)} for each part of a mask column that falls in one tile: {src} is
+    //  {n} mask words, which line up with tile rows [offset, offset + n) of tile ({bx}, {by}).
+    template<typename _Fn>
+    static void forEachSlice(qbitmask const &mask, _Fn fn)
+    {
+        if (mask.empty())
+            return;
+
+        int top = mask.rect.y, bottom = mask.rect.y + mask.rect.height;
+        for (int i = 0; i < mask.stride; ++i)
+        {
+            uint64_t const *column = mask.getColumn(i);
+            for (int by = (top >> BLOCK_SHIFT); (by << BLOCK_SHIFT) < bottom; ++by)
+            {
+                int y0 = std::max(top, by << BLOCK_SHIFT);
+                int y1 = std::min(bottom, (by + 1) << BLOCK_SHIFT);
+                fn(mask.firstWord + i, by, column + (y0 - top), y0 & 63, y1 - y0);
+            }
+        }
+    }
+
+    //  Calls {fn(occupancy, src, dst, n)} for each mask column slice over a non-empty tile, where {src}
+    //  is the slice's {n} mask words and {dst} the matching tile rows (null over a full tile, since
+    //  full tiles need not be read). Stops early if {fn} returns false.
+    template<typename _Fn>
+    void forEachBlock(qbitmask const &mask, _Fn fn) const
+    {
+        if (mask.empty())
+            return;
+
+        int top = mask.rect.y, bottom = mask.rect.y + mask.rect.height;
+        for (int by = (top >> BLOCK_SHIFT); (by << BLOCK_SHIFT) < bottom; ++by)
+        {
+            int y0 = std::max(top, by << BLOCK_SHIFT);
+            int y1 = std::min(bottom, (by + 1) << BLOCK_SHIFT);
+            for (int i = 0; i < mask.stride; ++i)
+            {
+                Occupancy occupancy = getBlockOccupancy(mask.firstWord + i, by);
+                if (occupancy == Occupancy::EMPTY)
+                    continue;
+                uint64_t const *src = mask.getColumn(i) + (y0 - top);
+                uint64_t const *dst = (occupancy == Occupancy::MIXED ? getTile(mask.firstWord + i, by)->rows + (y0 & 63) : nullptr);
+                if (!fn(occupancy, src, dst, y1 - y0))
+                    return;
+            }
+        }
+    }
+};
@@ -0,0 +1,356 @@
+#pragma once
+
+#include <cstdint>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define QBIT_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(QBIT_X64) && (defined(__GNUC__) || defined(__clang__))
+#define QBIT_TARGET(features) __attribute__((target(features)))
+#else
+#define QBIT_TARGET(features)
+#endif
+
+
+//  Word-stream kernels for the bit field
+//  Each kernel works on two runs of {n} consecutive words (a mask column against a tile column),
+//  fusing the logical operation with the test or count the caller needs.
+//  The implementation is chosen at first use from the CPU's features: AVX-512 (with VPOPCNTDQ), AVX2,
+//  or portable scalar code. setLevel() forces a lower level, for benchmarking.
+class qbitKernels
+{
+public:
+    enum class Level { SCALAR, AVX2, AVX512 };
+
+    struct Table
+    {
+        bool (*any)(uint64_t const *a, int n);                              // any bit set in a
+        bool (*anyAnd)(uint64_t const *a, uint64_t const *b, int n);        // any bit set in a & b
+        long long (*countAnd)(uint64_t const *a, uint64_t const *b, int n); // popcount(a & b)
+        int (*orCount)(uint64_t *dst, uint64_t const *src, int n);          // dst |= src, returns bits added
+        int (*andNotCount)(uint64_t *dst, uint64_t const *src, int n);      // dst &= ~src, returns bits removed
+    };
+
+    static Table const & get() { return *getCurrent(); }
+
+    static Level getLevel() { return getCurrentLevel(); }
+
+    static Level getBestLevel()
+    {
+        static Level const best = detect();
+        return best;
+    }
+
+    //  Selects {level}, or the best supported level below it
+    static Level setLevel(Level level)
+    {
+        if ((int)level > (int)getBestLevel())
+            level = getBestLevel();
+        getCurrentLevel() = level;
+        getCurrent() = &getTable(level);
+        return level;
+    }
+
+    static char const * getLevelName(Level level)
+    {
+        switch (level)
+        {
+        case Level::AVX512: return "avx512";
+        case Level::AVX2: return "avx2";
+        default: return "scalar";
+        }
+    }
+
+private:
+    static Level & getCurrentLevel()
+    {
+        static Level level = getBestLevel();
+        return level;
+    }
+
+    static Table const *& getCurrent()
+    {
+        static Table const *table = &getTable(getCurrentLevel());
+        return table;
+    }
+
+    static Table const & getTable(Level level)
+    {
+        static Table const scalar = { anyScalar, anyAndScalar, countAndScalar, orCountScalar, andNotCountScalar };
+#ifdef QBIT_X64
+        static Table const avx2 = { anyAvx2, anyAndAvx2, countAndAvx2, orCountAvx2, andNotCountAvx2 };
+        static Table const avx512 = { anyAvx512, anyAndAvx512, countAndAvx512, orCountAvx512, andNotCountAvx512 };
+        if (level == Level::AVX512)
+            return avx512;
+        if (level == Level::AVX2)
+            return avx2;
+#endif
+        return scalar;
+    }
+
+    static Level detect()
+    {
+#ifdef QBIT_X64
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return Level::SCALAR;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave)
+            return Level::SCALAR;
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+        bool avx512 = (info[1] & (1 << 16)) && (info[2] & (1 << 14)) && (xcr0 & 0xE6) == 0xE6;
+#else
+        __builtin_cpu_init();
+        bool avx2 = __builtin_cpu_supports("avx2");
+        bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+        if (avx512)
+            return Level::AVX512;
+        if (avx2)
+            return Level::AVX2;
+#endif
+        return Level::SCALAR;
+    }
+
+#pragma region Scalar
+
+    static bool anyScalar(uint64_t const *a, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            if (a[i])
+                return true;
+        return false;
+    }
+
+    static bool anyAndScalar(uint64_t const *a, uint64_t const *b, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            if (a[i] & b[i])
+                return true;
+        return false;
+    }
+
+    static long long countAndScalar(uint64_t const *a, uint64_t const *b, int n)
+    {
+        long long count = 0;
+        for (int i = 0; i < n; ++i)
+            count += std::popcount(a[i] & b[i]);
+        return count;
+    }
+
+    static int orCountScalar(uint64_t *dst, uint64_t const *src, int n)
+    {
+        int added = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            added += std::popcount(src[i] & ~dst[i]);
+            dst[i] |= src[i];
+        }
+        return added;
+    }
+
+    static int andNotCountScalar(uint64_t *dst, uint64_t const *src, int n)
+    {
+        int removed = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            removed += std::popcount(src[i] & dst[i]);
+            dst[i] &= ~src[i];
+        }
+        return removed;
+    }
+
+#pragma endregion
+
+#ifdef QBIT_X64
+
+#pragma region AVX2
+
+    //  per-64-bit-lane popcount, by nibble lookup
+    QBIT_TARGET("avx2")
+    static __m256i popcount256(__m256i v)
+    {
+        __m256i const lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        __m256i const low = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+    }
+
+    QBIT_TARGET("avx2")
+    static long long sum256(__m256i v)
+    {
+        __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+    }
+
+    QBIT_TARGET("avx2")
+    static bool anyAvx2(uint64_t const *a, int n)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i va = _mm256_loadu_si256((__m256i const *)(a + i));
+            if (!_mm256_testz_si256(va, va))
+                return true;
+        }
+        return anyScalar(a + i, n - i);
+    }
+
+    QBIT_TARGET("avx2")
+    static bool anyAndAvx2(uint64_t const *a, uint64_t const *b, int n)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i va = _mm256_loadu_si256((__m256i const *)(a + i));
+            __m256i vb = _mm256_loadu_si256((__m256i const *)(b + i));
+            if (!_mm256_testz_si256(va, vb))
+                return true;
+        }
+        return anyAndScalar(a + i, b + i, n - i);
+    }
+
+    QBIT_TARGET("avx2")
+    static long long countAndAvx2(uint64_t const *a, uint64_t const *b, int n)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i va = _mm256_loadu_si256((__m256i const *)(a + i));
+            __m256i vb = _mm256_loadu_si256((__m256i const *)(b + i));
+            sum = _mm256_add_epi64(sum, popcount256(_mm256_and_si256(va, vb)));
+        }
+        return sum256(sum) + countAndScalar(a + i, b + i, n - i);
+    }
+
+    QBIT_TARGET("avx2")
+    static int orCountAvx2(uint64_t *dst, uint64_t const *src, int n)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i vd = _mm256_loadu_si256((__m256i const *)(dst + i));
+            __m256i vs = _mm256_loadu_si256((__m256i const *)(src + i));
+            sum = _mm256_add_epi64(sum, popcount256(_mm256_andnot_si256(vd, vs)));
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(vd, vs));
+        }
+        return (int)sum256(sum) + orCountScalar(dst + i, src + i, n - i);
+    }
+
+    QBIT_TARGET("avx2")
+    static int andNotCountAvx2(uint64_t *dst, uint64_t const *src, int n)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i vd = _mm256_loadu_si256((__m256i const *)(dst + i));
+            __m256i vs = _mm256_loadu_si256((__m256i const *)(src + i));
+            sum = _mm256_add_epi64(sum, popcount256(_mm256_and_si256(vd, vs)));
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(vs, vd));
+        }
+        return (int)sum256(sum) + andNotCountScalar(dst + i, src + i, n - i);
+    }
+
+#pragma endregion
+
+#pragma region AVX-512
+
+    //  AVX-512 kernels use masked loads for the tail, so short runs take a single iteration
+
+    QBIT_TARGET("avx512f")
+    static __mmask8 getTailMask(int remaining)
+    {
+        return (__mmask8)(remaining >= 8 ? 0xff : (1u << remaining) - 1);
+    }
+
+    QBIT_TARGET("avx512f")
+    static bool anyAvx512(uint64_t const *a, int n)
+    {
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 m = getTailMask(n - i);
+            __m512i va = _mm512_maskz_loadu_epi64(m, a + i);
+            if (_mm512_test_epi64_mask(va, va))
+                return true;
+        }
+        return false;
+    }
+
+    QBIT_TARGET("avx512f")
+    static bool anyAndAvx512(uint64_t const *a, uint64_t const *b, int n)
+    {
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 m = getTailMask(n - i);
+            __m512i va = _mm512_maskz_loadu_epi64(m, a + i);
+            __m512i vb = _mm512_maskz_loadu_epi64(m, b + i);
+            if (_mm512_test_epi64_mask(va, vb))
+                return true;
+        }
+        return false;
+    }
+
+    QBIT_TARGET("avx512f,avx512vpopcntdq")
+    static long long countAndAvx512(uint64_t const *a, uint64_t const *b, int n)
+    {
+        __m512i sum = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 m = getTailMask(n - i);
+            __m512i va = _mm512_maskz_loadu_epi64(m, a + i);
+            __m512i vb = _mm512_maskz_loadu_epi64(m, b + i);
+            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_and_si512(va, vb)));
+        }
+        return _mm512_reduce_add_epi64(sum);
+    }
+
+    QBIT_TARGET("avx512f,avx512vpopcntdq")
+    static int orCountAvx512(uint64_t *dst, uint64_t const *src, int n)
+    {
+        __m512i sum = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 m = getTailMask(n - i);
+            __m512i vd = _mm512_maskz_loadu_epi64(m, dst + i);
+            __m512i vs = _mm512_maskz_loadu_epi64(m, src + i);
+            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_andnot_si512(vd, vs)));
+            _mm512_mask_storeu_epi64(dst + i, m, _mm512_or_si512(vd, vs));
+        }
+        return (int)_mm512_reduce_add_epi64(sum);
+    }
+
+    QBIT_TARGET("avx512f,avx512vpopcntdq")
+    static int andNotCountAvx512(uint64_t *dst, uint64_t const *src, int n)
+    {
+        __m512i sum = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 m = getTailMask(n - i);
+            __m512i vd = _mm512_maskz_loadu_epi64(m, dst + i);
+            __m512i vs = _mm512_maskz_loadu_epi64(m, src + i);
+            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_and_si512(vd, vs)));
+            _mm512_mask_storeu_epi64(dst + i, m, _mm512_andnot_si512(vs, vd));
+        }
+        return (int)_mm512_reduce_add_epi64(sum);
+    }
+
+#pragma endregion
+
+#endif
+};
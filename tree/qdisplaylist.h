@@ -0,0 +1,109 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+
+
+//  Retained record of the polygons drawn on a qcanvas, in draw order, so the drawing can be replayed
+//  at any resolution or line setting without regrowing the tree.
+//  Outlines are stored once and shared: every draw of an identical polygon references the same copy.
+//  Items are kept to 32 bytes; colors are stored as 8-bit BGRA, which is all the canvas outputs hold.
+class qdisplayList
+{
+public:
+    struct Item
+    {
+        cv::Matx23f transform;      // model transform; node transforms are affine
+        cv::Vec4b   color;          // BGRA
+        int         polygon;        // index into getPolygons()
+    };
+
+private:
+    std::vector<std::vector<cv::Point2f> > m_polygons;
+    std::unordered_multimap<size_t, int> m_polygonIds;     // outline hash -> index
+    std::vector<Item> m_items;
+
+public:
+    void clear()
+    {
+        m_polygons.clear();
+        m_polygonIds.clear();
+        m_items.clear();
+    }
+
+    bool empty() const { return m_items.empty(); }
+    size_t size() const { return m_items.size(); }
+
+    std::vector<Item> const & getItems() const { return m_items; }
+    std::vector<std::vector<cv::Point2f> > const & getPolygons() const { return m_polygons; }
+
+    //  Index of {polygon} in the outline table, adding it if it's new.
+    //  New outlines always take the next index.
+    int addPolygon(std::vector<cv::Point2f> const &polygon)
+    {
+        // trees mostly draw one outline over and over
+        if (!m_polygons.empty() && m_polygons.back() == polygon)
+            return (int)m_polygons.size() - 1;
+
+        size_t hash = hashPolygon(polygon);
+        auto range = m_polygonIds.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (m_polygons[it->second] == polygon)
+                return it->second;
+        }
+
+        int index = (int)m_polygons.size();
+        m_polygons.push_back(polygon);
+        m_polygonIds.emplace(hash, index);
+        return index;
+    }
+
+    int add(std::vector<cv::Point2f> const &polygon, cv::Matx33f const &transform, cv::Scalar color)
+    {
+        int index = addPolygon(polygon);
+        m_items.push_back({ transform.get_minor<2, 3>(0, 0), cv::Vec4b(
+            cv::saturate_cast<uint8_t>(color[0]), cv::saturate_cast<uint8_t>(color[1]),
+            cv::saturate_cast<uint8_t>(color[2]), cv::saturate_cast<uint8_t>(color[3])), index });
+        return index;
+    }
+
+    static cv::Matx33f getTransform(Item const &item)
+    {
+        cv::Matx23f const &t = item.transform;
+        return cv::Matx33f(t(0, 0), t(0, 1), t(0, 2), t(1, 0), t(1, 1), t(1, 2), 0.0f, 0.0f, 1.0f);
+    }
+
+    static cv::Scalar getColor(Item const &item)
+    {
+        return cv::Scalar(item.color[0], item.color[1], item.color[2], item.color[3]);
+    }
+
+    size_t getMemorySize() const
+    {
+        size_t size = m_items.capacity() * sizeof(Item) + m_polygons.capacity() * sizeof(m_polygons[0])
+            + m_polygonIds.bucket_count() * sizeof(void *) + m_polygonIds.size() * (sizeof(std::pair<size_t const, int>) + 2 * sizeof(void *));
+        for (auto const &polygon : m_polygons)
+            size += polygon.capacity() * sizeof(cv::Point2f);
+        return size;
+    }
+
+private:
+    static size_t hashPolygon(std::vector<cv::Point2f> const &polygon)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (auto const &p : polygon)
+        {
+            uint32_t bits[2];
+            std::memcpy(bits, &p, sizeof(bits));
+            h = (h ^ bits[0]) * 1099511628211ull;
+            h = (h ^ bits[1]) * 1099511628211ull;
+        }
+        return (size_t)h;
+    }
+};
+
+static_assert(sizeof(qdisplayList::Item) == 32, "display list items should stay compact");
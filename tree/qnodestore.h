@@ -0,0 +1,205 @@
+#pragma once
+
+#include "tree.h"
+#include <vector>
+#include <unordered_map>
+
+
+//  Committed-node store
+//  Nodes are kept contiguously in insertion order. Each node keeps its slot for its whole lifetime:
+//  removal leaves a tombstone rather than shifting later nodes, and an id-to-slot index gives
+//  constant-time lookup by node id.
+//  Parent, first-child and next-sibling slot links are kept for each node, so ancestor walks and
+//  subtree removal never need to search.
+class qnodeStore
+{
+    std::vector<qnode> m_nodes;
+    std::vector<char> m_live;
+    std::unordered_map<int, int> m_slots;   // node id -> slot
+
+    // adjacency, by slot; -1 for none
+    std::vector<int> m_parent;
+    std::vector<int> m_firstChild;
+    std::vector<int> m_nextSibling;
+
+public:
+    //  Iterates live nodes in insertion order
+    template<typename _Store, typename _Node>
+    class basic_iterator
+    {
+        _Store *m_store;
+        int m_slot;
+
+    public:
+        basic_iterator(_Store *store, int slot) : m_store(store), m_slot(slot) { skipDead(); }
+
+        _Node & operator*() const { return m_store->m_nodes[m_slot]; }
+        _Node * operator->() const { return &m_store->m_nodes[m_slot]; }
+        basic_iterator & operator++() { ++m_slot; skipDead(); return *this; }
+        bool operator==(basic_iterator const &it) const { return m_slot == it.m_slot; }
+        bool operator!=(basic_iterator const &it) const { return m_slot != it.m_slot; }
+        int slot() const { return m_slot; }
+
+    private:
+        void skipDead()
+        {
+            while (m_slot < (int)m_store->m_nodes.size() && !m_store->m_live[m_slot])
+                ++m_slot;
+        }
+    };
+
+    typedef basic_iterator<qnodeStore, qnode> iterator;
+    typedef basic_iterator<qnodeStore const, qnode const> const_iterator;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, slotCount()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slotCount()); }
+
+    //  Adds a node, returning its slot. The node is linked to its parent if the parent is present.
+    int add(qnode const &node)
+    {
+        int slot = slotCount();
+        int parent = (node.parentId == node.id ? -1 : findSlot(node.parentId));
+
+        m_nodes.push_back(node);
+        m_live.push_back(1);
+        m_slots[node.id] = slot;
+
+        m_parent.push_back(parent);
+        m_firstChild.push_back(-1);
+        m_nextSibling.push_back(-1);
+        if (parent >= 0)
+        {
+            m_nextSibling[slot] = m_firstChild[parent];
+            m_firstChild[parent] = slot;
+        }
+
+        return slot;
+    }
+
+    //  Returns the slot of node {id}, or -1 if not present
+    int findSlot(int id) const
+    {
+        auto it = m_slots.find(id);
+        return (it == m_slots.end() ? -1 : it->second);
+    }
+
+    qnode const * find(int id) const
+    {
+        int slot = findSlot(id);
+        return (slot < 0 ? nullptr : &m_nodes[slot]);
+    }
+
+    qnode * find(int id)
+    {
+        int slot = findSlot(id);
+        return (slot < 0 ? nullptr : &m_nodes[slot]);
+    }
+
+    qnode const & at(int slot) const { return m_nodes[slot]; }
+    qnode & at(int slot) { return m_nodes[slot]; }
+
+    bool isLive(int slot) const { return (slot >= 0 && slot < slotCount() && m_live[slot]); }
+
+    int getParentSlot(int slot) const { return m_parent[slot]; }
+    int getFirstChildSlot(int slot) const { return m_firstChild[slot]; }
+    int getNextSiblingSlot(int slot) const { return m_nextSibling[slot]; }
+
+    //  Removes node {id}, leaving its children as roots. Its slot is not reused.
+    bool remove(int id)
+    {
+        int slot = findSlot(id);
+        if (slot < 0)
+            return false;
+
+        unlink(slot);
+        for (int child = m_firstChild[slot]; child >= 0; child = m_nextSibling[child])
+            m_parent[child] = -1;
+        m_firstChild[slot] = -1;
+
+        kill(slot);
+        return true;
+    }
+
+    //  Removes node {id} and all of its descendants, in time proportional to the subtree.
+    //  Slots of removed nodes are appended to {removedSlots}, parents before children.
+    //  Returns the number of nodes removed.
+    int removeSubtree(int id, std::vector<int> *removedSlots = nullptr)
+    {
+        int slot = findSlot(id);
+        if (slot < 0)
+            return 0;
+
+        unlink(slot);
+
+        int removed = 0;
+        std::vector<int> stack(1, slot);
+        while (!stack.empty())
+        {
+            int s = stack.back();
+            stack.pop_back();
+
+            for (int child = m_firstChild[s]; child >= 0; child = m_nextSibling[child])
+                stack.push_back(child);
+
+            kill(s);
+            ++removed;
+            if (removedSlots)
+                removedSlots->push_back(s);
+        }
+
+        return removed;
+    }
+
+    //  number of live nodes
+    size_t size() const { return m_slots.size(); }
+
+    bool empty() const { return m_slots.empty(); }
+
+    //  number of slots used, including removed nodes
+    int slotCount() const { return (int)m_nodes.size(); }
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_live.clear();
+        m_slots.clear();
+        m_parent.clear();
+        m_firstChild.clear();
+        m_nextSibling.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        m_nodes.reserve(n);
+        m_live.reserve(n);
+        m_slots.reserve(n);
+        m_parent.reserve(n);
+        m_firstChild.reserve(n);
+        m_nextSibling.reserve(n);
+    }
+
+private:
+    //  detaches a slot from its parent's child list
+    void unlink(int slot)
+    {
+        int parent = m_parent[slot];
+        if (parent < 0)
+            return;
+
+        int *link = &m_firstChild[parent];
+        while (*link != slot)
+            link = &m_nextSibling[*link];
+        *link = m_nextSibling[slot];
+
+        m_parent[slot] = -1;
+        m_nextSibling[slot] = -1;
+    }
+
+    void kill(int slot)
+    {
+        m_live[slot] = 0;
+        m_slots.erase(m_nodes[slot].id);
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "qbitfield.h"
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <bit>
+
+
+//  Node id of each occupied field cell
+//  Stored sparsely, in 64x64-cell tiles on the same grid as qbitfield, allocated when a cell in them is
+//  first claimed and released when their last cell is. Lookup is a single read; removing a node clears
+//  exactly the cells it claimed, so neighbors are never touched.
+//  claim() may be called from several threads at once for masks covering disjoint tiles.
+class qownerField
+{
+public:
+    static constexpr int NONE = -1;
+
+private:
+    struct Tile
+    {
+        int32_t cells[64 * 64];
+        int count = 0;          // owned cells
+
+        Tile() { std::fill(cells, cells + 64 * 64, NONE); }
+    };
+
+    int m_rows = 0;
+    int m_cols = 0;
+    int m_stride = 0;           // tiles per tile row
+    std::vector<std::unique_ptr<Tile> > m_tiles;
+    std::atomic<size_t> m_tileCount{ 0 };
+
+public:
+    void create(cv::Size size)
+    {
+        m_rows = size.height;
+        m_cols = size.width;
+        m_stride = (m_cols + 63) >> 6;
+        m_tiles.clear();
+        m_tiles.resize((size_t)m_stride * ((m_rows + 63) >> 6));
+        m_tileCount = 0;
+    }
+
+    void clear()
+    {
+        for (auto &tile : m_tiles)
+            tile.reset();
+        m_tileCount = 0;
+    }
+
+    bool empty() const { return (m_rows == 0 || m_cols == 0); }
+
+    size_t getMemorySize() const
+    {
+        return m_tileCount * sizeof(Tile) + m_tiles.size() * sizeof(m_tiles[0]);
+    }
+
+    //  Owner of cell ({x}, {y}), or NONE
+    int get(int x, int y) const
+    {
+        Tile const *tile = m_tiles[(size_t)(y >> 6) * m_stride + (x >> 6)].get();
+        return (tile ? tile->cells[((y & 63) << 6) + (x & 63)] : NONE);
+    }
+
+    //  Sets {id} as the owner of the cells of {mask} that have none
+    void claim(qbitmask const &mask, int id)
+    {
+        // mask words are on the field's word grid, so each word lies in one tile row
+        for (int y = 0; y < mask.rect.height; ++y)
+        {
+            int fy = mask.rect.y + y;
+            for (int i = 0; i < mask.stride; ++i)
+            {
+                uint64_t bits = mask.getWord(y, i);
+                if (!bits)
+                    continue;
+
+                auto &tile = m_tiles[(size_t)(fy >> 6) * m_stride + mask.firstWord + i];
+                if (!tile)
+                {
+                    tile.reset(new Tile);
+                    m_tileCount++;
+                }
+
+                int32_t *row = tile->cells + ((fy & 63) << 6);
+                while (bits)
+                {
+                    int x = std::countr_zero(bits);
+                    if (row[x] == NONE)
+                    {
+                        row[x] = id;
+                        tile->count++;
+                    }
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    //  Clears the cells of {rect} owned by {id}, and returns them as {owned}
+    void release(cv::Rect const &rect, int id, qbitmask &owned)
+    {
+        owned.create(rect);
+        forEachTileRow(rect, [&](size_t index, int y, int x0, int x1)
+        {
+            auto &tile = m_tiles[index];
+            int32_t *row = tile->cells + ((y & 63) << 6);
+            for (int x = x0; x <= x1; ++x)
+            {
+                if (row[x & 63] != id)
+                    continue;
+                row[x & 63] = NONE;
+                owned.getWord(y - rect.y, (x >> 6) - owned.firstWord) |= (uint64_t(1) << (x & 63));
+                tile->count--;
+            }
+            if (tile->count == 0)
+            {
+                tile.reset();
+                m_tileCount--;
+            }
+        });
+    }
+
+    //  Appends the distinct owners of cells in {rect}, in increasing order
+    void getOwners(cv::Rect const &rect, std::vector<int> &ids) const
+    {
+        size_t first = ids.size();
+        forEachTileRow(rect, [&](size_t index, int y, int x0, int x1)
+        {
+            int32_t const *row = m_tiles[index]->cells + ((y & 63) << 6);
+            for (int x = x0; x <= x1; ++x)
+            {
+                if (row[x & 63] != NONE)
+                    ids.push_back(row[x & 63]);
+            }
+        });
+        std::sort(ids.begin() + first, ids.end());
+        ids.erase(std::unique(ids.begin() + first, ids.end()), ids.end());
+    }
+
+private:
+    //  Calls {fn(tileIndex, y, x0, x1)} for each row part [x0, x1] of {rect} in an allocated tile
+    template<typename _Fn>
+    void forEachTileRow(cv::Rect rect, _Fn fn) const
+    {
+        rect &= cv::Rect(0, 0, m_cols, m_rows);
+        for (int y = rect.y; y < rect.y + rect.height; ++y)
+        {
+            for (int bx = (rect.x >> 6); (bx << 6) < rect.x + rect.width; ++bx)
+            {
+                size_t index = (size_t)(y >> 6) * m_stride + bx;
+                if (!m_tiles[index])
+                    continue;
+                fn(index, y, std::max(rect.x, bx << 6), std::min(rect.x + rect.width, (bx + 1) << 6) - 1);
+            }
+        }
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+
+//  Exact polygon collision against committed polygons, in model coordinates
+//  Committed polygons are binned by bounding box into a uniform grid, so a query only tests
+//  polygons in the cells its own bounding box covers.
+//  Polygons that merely touch--along a shared edge or at a vertex, within {epsilon}--do not collide,
+//  matching the raster field, where each node's outline is shaved off.
+//  Convex polygons are tested with the separating axis theorem; otherwise, with proper segment
+//  crossings plus containment of vertices, edge midpoints and the vertex mean.
+class qpolygonIndex
+{
+    struct Entry
+    {
+        std::vector<cv::Point2d> pts;
+        cv::Rect2d bounds;
+        int id;
+    };
+
+    std::vector<Entry> m_entries;
+    std::vector<int> m_freeSlots;
+    std::unordered_map<int, int> m_slots;       // node id -> entry
+    size_t m_size = 0;
+
+    std::vector<std::vector<int> > m_cells;     // entry indices
+    cv::Rect2d m_bounds;
+    double m_cellSize = 1.0;
+    int m_cols = 0;
+    int m_rows = 0;
+
+    bool m_convex = false;
+    double m_epsilon = 1e-4;
+
+public:
+    //  {convex}: all polygons are convex, so SAT can be used
+    void create(cv::Rect_<float> const &bounds, double cellSize, bool convex, double epsilon)
+    {
+        m_bounds = cv::Rect2d(bounds.x, bounds.y, bounds.width, bounds.height);
+        m_cellSize = cellSize;
+        m_cols = std::max(1, (int)std::ceil(m_bounds.width / m_cellSize));
+        m_rows = std::max(1, (int)std::ceil(m_bounds.height / m_cellSize));
+        m_convex = convex;
+        m_epsilon = epsilon;
+        clear();
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_freeSlots.clear();
+        m_slots.clear();
+        m_size = 0;
+        m_cells.assign((size_t)m_cols * m_rows, std::vector<int>());
+    }
+
+    size_t size() const { return m_size; }
+
+    void insert(int id, std::vector<cv::Point2f> const &pts)
+    {
+        int slot;
+        if (m_freeSlots.empty())
+        {
+            slot = (int)m_entries.size();
+            m_entries.emplace_back();
+        }
+        else
+        {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+
+        Entry &entry = m_entries[slot];
+        entry.id = id;
+        entry.pts.assign(pts.begin(), pts.end());
+        entry.bounds = getBounds(entry.pts);
+        m_slots[id] = slot;
+        m_size++;
+
+        forEachCell(entry.bounds, [&](std::vector<int> &cell) { cell.push_back(slot); });
+    }
+
+    void remove(int id)
+    {
+        auto it = m_slots.find(id);
+        if (it == m_slots.end())
+            return;
+
+        int slot = it->second;
+        forEachCell(m_entries[slot].bounds, [&](std::vector<int> &cell)
+        {
+            cell.erase(std::find(cell.begin(), cell.end(), slot));
+        });
+
+        m_entries[slot].pts.clear();
+        m_freeSlots.push_back(slot);
+        m_slots.erase(it);
+        m_size--;
+    }
+
+    //  true if {pts} overlaps any committed polygon
+    bool intersects(std::vector<cv::Point2f> const &pts) const
+    {
+        std::vector<cv::Point2d> a(pts.begin(), pts.end());
+        cv::Rect2d bounds = getBounds(a);
+
+        // gather each polygon once, even if it spans several cells
+        thread_local std::vector<int> candidates;
+        candidates.clear();
+        int cx0, cx1, cy0, cy1;
+        getCellRange(bounds, cx0, cx1, cy0, cy1);
+        for (int cy = cy0; cy <= cy1; ++cy)
+        {
+            for (int cx = cx0; cx <= cx1; ++cx)
+            {
+                auto const &cell = m_cells[(size_t)cy * m_cols + cx];
+                candidates.insert(candidates.end(), cell.begin(), cell.end());
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        for (int slot : candidates)
+        {
+            Entry const &entry = m_entries[slot];
+            if (!overlaps(bounds, entry.bounds))
+                continue;
+            if (m_convex ? overlapsConvex(a, entry.pts) : overlapsGeneral(a, entry.pts))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static cv::Rect2d getBounds(std::vector<cv::Point2d> const &pts)
+    {
+        double x0 = pts[0].x, y0 = pts[0].y, x1 = x0, y1 = y0;
+        for (auto const &p : pts)
+        {
+            x0 = std::min(x0, p.x); x1 = std::max(x1, p.x);
+            y0 = std::min(y0, p.y); y1 = std::max(y1, p.y);
+        }
+        return cv::Rect2d(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    void getCellRange(cv::Rect2d const &bounds, int &cx0, int &cx1, int &cy0, int &cy1) const
+    {
+        cx0 = getCell(bounds.x - m_bounds.x, m_cols);
+        cx1 = getCell(bounds.x + bounds.width - m_bounds.x, m_cols);
+        cy0 = getCell(bounds.y - m_bounds.y, m_rows);
+        cy1 = getCell(bounds.y + bounds.height - m_bounds.y, m_rows);
+    }
+
+    template<typename _Fn>
+    void forEachCell(cv::Rect2d const &bounds, _Fn fn)
+    {
+        int cx0, cx1, cy0, cy1;
+        getCellRange(bounds, cx0, cx1, cy0, cy1);
+        for (int cy = cy0; cy <= cy1; ++cy)
+            for (int cx = cx0; cx <= cx1; ++cx)
+                fn(m_cells[(size_t)cy * m_cols + cx]);
+    }
+
+    int getCell(double offset, int count) const
+    {
+        return std::min(count - 1, std::max(0, (int)std::floor(offset / m_cellSize)));
+    }
+
+    //  bounding boxes overlap by more than epsilon
+    bool overlaps(cv::Rect2d const &a, cv::Rect2d const &b) const
+    {
+        return (a.x + a.width > b.x + m_epsilon && b.x + b.width > a.x + m_epsilon
+            && a.y + a.height > b.y + m_epsilon && b.y + b.height > a.y + m_epsilon);
+    }
+
+    static double cross(cv::Point2d const &a, cv::Point2d const &b)
+    {
+        return a.x * b.y - a.y * b.x;
+    }
+
+#pragma region Convex
+
+    bool overlapsConvex(std::vector<cv::Point2d> const &a, std::vector<cv::Point2d> const &b) const
+    {
+        return !hasSeparatingAxis(a, b) && !hasSeparatingAxis(b, a);
+    }
+
+    //  true if the normal of some edge of {a} separates the polygons, allowing epsilon of overlap
+    bool hasSeparatingAxis(std::vector<cv::Point2d> const &a, std::vector<cv::Point2d> const &b) const
+    {
+        size_t n = a.size();
+        for (size_t i = 0; i < n; ++i)
+        {
+            cv::Point2d edge = a[(i + 1) % n] - a[i];
+            double length = std::sqrt(edge.dot(edge));
+            if (length <= 0.0)
+                continue;
+            cv::Point2d axis(-edge.y / length, edge.x / length);
+
+            double minA, maxA, minB, maxB;
+            project(a, axis, minA, maxA);
+            project(b, axis, minB, maxB);
+            if (maxA <= minB + m_epsilon || maxB <= minA + m_epsilon)
+                return true;
+        }
+        return false;
+    }
+
+    static void project(std::vector<cv::Point2d> const &pts, cv::Point2d const &axis, double &lo, double &hi)
+    {
+        lo = hi = pts[0].dot(axis);
+        for (auto const &p : pts)
+        {
+            double d = p.dot(axis);
+            lo = std::min(lo, d);
+            hi = std::max(hi, d);
+        }
+    }
+
+#pragma endregion
+
+#pragma region General
+
+    bool overlapsGeneral(std::vector<cv::Point2d> const &a, std::vector<cv::Point2d> const &b) const
+    {
+        size_t na = a.size(), nb = b.size();
+        for (size_t i = 0; i < na; ++i)
+        {
+            for (size_t j = 0; j < nb; ++j)
+            {
+                if (segmentsCross(a[i], a[(i + 1) % na], b[j], b[(j + 1) % nb]))
+                    return true;
+            }
+        }
+
+        // no edges cross, so either one polygon is inside the other or they are disjoint
+        return containsAnyPoint(b, a) || containsAnyPoint(a, b);
+    }
+
+    //  true if the segments cross at a point more than epsilon from both lines' ends and from collinearity
+    bool segmentsCross(cv::Point2d const &a0, cv::Point2d const &a1, cv::Point2d const &b0, cv::Point2d const &b1) const
+    {
+        cv::Point2d da = a1 - a0, db = b1 - b0;
+        double la = std::sqrt(da.dot(da)), lb = std::sqrt(db.dot(db));
+        if (la <= 0.0 || lb <= 0.0)
+            return false;
+
+        // signed distances of each segment's ends from the other segment's line
+        double d0 = cross(db, a0 - b0) / lb;
+        double d1 = cross(db, a1 - b0) / lb;
+        double d2 = cross(da, b0 - a0) / la;
+        double d3 = cross(da, b1 - a0) / la;
+
+        return ((d0 > m_epsilon && d1 < -m_epsilon) || (d0 < -m_epsilon && d1 > m_epsilon))
+            && ((d2 > m_epsilon && d3 < -m_epsilon) || (d2 < -m_epsilon && d3 > m_epsilon));
+    }
+
+    //  true if {polygon} strictly contains a vertex, edge midpoint or the vertex mean of {pts}
+    bool containsAnyPoint(std::vector<cv::Point2d> const &polygon, std::vector<cv::Point2d> const &pts) const
+    {
+        cv::Point2d mean(0, 0);
+        size_t n = pts.size();
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (containsPoint(polygon, pts[i]) || containsPoint(polygon, 0.5 * (pts[i] + pts[(i + 1) % n])))
+                return true;
+            mean += pts[i];
+        }
+        return containsPoint(polygon, mean * (1.0 / n));
+    }
+
+    //  true if {p} is inside {polygon} and more than epsilon from its boundary
+    bool containsPoint(std::vector<cv::Point2d> const &polygon, cv::Point2d const &p) const
+    {
+        bool inside = false;
+        size_t n = polygon.size();
+        for (size_t i = 0, j = n - 1; i < n; j = i++)
+        {
+            cv::Point2d const &u = polygon[j], &v = polygon[i];
+
+            // distance to edge
+            cv::Point2d e = v - u;
+            double len2 = e.dot(e);
+            double t = (len2 > 0.0 ? std::min(1.0, std::max(0.0, (p - u).dot(e) / len2)) : 0.0);
+            cv::Point2d d = p - (u + t * e);
+            if (d.dot(d) <= m_epsilon * m_epsilon)
+                return false;
+
+            // even-odd crossing
+            if ((u.y > p.y) != (v.y > p.y) && p.x < u.x + (p.y - u.y) * e.x / e.y)
+                inside = !inside;
+        }
+        return inside;
+    }
+
+#pragma endregion
+};
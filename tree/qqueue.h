@@ -0,0 +1,229 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+
+//  Priority queues of pending nodes
+//  qtree talks to its queue through qqueue; the engine behind it is selectable.
+//  All engines pop in exactly the same order, defined by _Compare, which is a "later than" ordering
+//  as for std::priority_queue: top() is the element that no other element precedes.
+//  _Compare must be a total order: a heap leaves ties in an order that depends on the history of
+//  pushes and pops, so serial and batch processing, or two engines, would otherwise disagree.
+
+enum class QueueEngine
+{
+    HEAP,       // binary heap, O(log n) push/pop
+    CALENDAR    // bucketed time queue keyed on beginTime, O(1) amortized for monotone keys
+};
+
+
+//  Number of calendar queue buckets, log2
+constexpr int CALENDAR_RING_SIZE_LOG2 = 10;
+
+//  Calendar bucket width that spreads keys due within {span} of the front across the whole ring
+inline double getCalendarBucketWidth(double span)
+{
+    double width = span / double(1 << CALENDAR_RING_SIZE_LOG2);
+    return (width > 0.0 && std::isfinite(width) ? width : 1.0);
+}
+
+
+template<typename _Node>
+class qqueueEngine
+{
+public:
+    virtual ~qqueueEngine() {}
+
+    virtual void push(_Node const &node) = 0;
+    virtual void pop() = 0;
+    virtual _Node const & top() const = 0;
+    virtual size_t size() const = 0;
+    virtual void clear() = 0;
+};
+
+
+#pragma region HeapQueueEngine
+
+template<typename _Node, typename _Compare>
+class HeapQueueEngine : public qqueueEngine<_Node>
+{
+    std::priority_queue<_Node, std::vector<_Node>, _Compare> m_heap;
+
+public:
+    virtual void push(_Node const &node) override { m_heap.push(node); }
+    virtual void pop() override { m_heap.pop(); }
+    virtual _Node const & top() const override { return m_heap.top(); }
+    virtual size_t size() const override { return m_heap.size(); }
+    virtual void clear() override { m_heap = decltype(m_heap)(); }
+};
+
+#pragma endregion
+
+#pragma region CalendarQueueEngine
+
+//  Calendar queue
+//  Nodes are binned by floor(beginTime / bucketWidth) into a ring of buckets covering a sliding window of time;
+//  nodes beyond the window wait in an overflow heap and are moved into the ring as the window advances.
+//  Each bucket is a small heap, so ties and near-ties still pop in _Compare order.
+//  Keys earlier than the current bucket are clamped into it, which keeps the order exact:
+//  such a node is still earlier than everything in later buckets.
+template<typename _Node, typename _Compare>
+class CalendarQueueEngine : public qqueueEngine<_Node>
+{
+    double m_bucketWidth;
+    std::vector<std::vector<_Node> > m_ring;
+    int64_t m_ringMask;
+    int64_t m_current = 0;          // absolute index of the bucket at the front of the queue
+    size_t m_ringCount = 0;         // number of nodes in the ring
+    std::vector<_Node> m_overflow;  // heap of nodes beyond the ring window
+    _Compare m_compare;
+
+public:
+    //  {ringSizeLog2}: the ring has 2^ringSizeLog2 buckets
+    CalendarQueueEngine(double bucketWidth = 1.0, int ringSizeLog2 = CALENDAR_RING_SIZE_LOG2)
+    {
+        m_bucketWidth = (bucketWidth > 0.0 ? bucketWidth : 1.0);
+        m_ring.resize(size_t(1) << ringSizeLog2);
+        m_ringMask = (int64_t(1) << ringSizeLog2) - 1;
+    }
+
+    virtual void push(_Node const &node) override
+    {
+        int64_t b = getBucketIndex(node);
+
+        if (size() == 0)
+        {
+            // empty: move the window to this node
+            m_current = b;
+        }
+
+        if (b - m_current <= m_ringMask)
+        {
+            pushBucket(std::max(b, m_current), node);
+        }
+        else
+        {
+            m_overflow.push_back(node);
+            std::push_heap(m_overflow.begin(), m_overflow.end(), m_compare);
+        }
+    }
+
+    virtual void pop() override
+    {
+        auto &bucket = m_ring[m_current & m_ringMask];
+        std::pop_heap(bucket.begin(), bucket.end(), m_compare);
+        bucket.pop_back();
+        --m_ringCount;
+
+        advance();
+    }
+
+    virtual _Node const & top() const override
+    {
+        return m_ring[m_current & m_ringMask].front();
+    }
+
+    virtual size_t size() const override
+    {
+        return m_ringCount + m_overflow.size();
+    }
+
+    virtual void clear() override
+    {
+        for (auto &bucket : m_ring)
+            std::vector<_Node>().swap(bucket);
+        std::vector<_Node>().swap(m_overflow);
+        m_ringCount = 0;
+        m_current = 0;
+    }
+
+private:
+    int64_t getBucketIndex(_Node const &node) const
+    {
+        // clamp to a range where the double->int conversion is exact
+        double b = std::floor(node.beginTime / m_bucketWidth);
+        return (int64_t)std::min(std::max(b, -9.0e15), 9.0e15);
+    }
+
+    void pushBucket(int64_t b, _Node const &node)
+    {
+        auto &bucket = m_ring[b & m_ringMask];
+        bucket.push_back(node);
+        std::push_heap(bucket.begin(), bucket.end(), m_compare);
+        ++m_ringCount;
+    }
+
+    //  restores the invariant that the front bucket is nonempty, unless the queue is empty
+    void advance()
+    {
+        if (size() == 0)
+            return;
+
+        while (m_ring[m_current & m_ringMask].empty())
+        {
+            if (m_ringCount == 0)
+            {
+                // nothing left in the window: jump ahead to the earliest overflow node
+                m_current = getBucketIndex(m_overflow.front());
+            }
+            else
+            {
+                ++m_current;
+            }
+
+            // move overflow nodes that are now inside the window into the ring
+            while (!m_overflow.empty() && getBucketIndex(m_overflow.front()) - m_current <= m_ringMask)
+            {
+                int64_t b = getBucketIndex(m_overflow.front());
+                std::pop_heap(m_overflow.begin(), m_overflow.end(), m_compare);
+                pushBucket(std::max(b, m_current), m_overflow.back());
+                m_overflow.pop_back();
+            }
+        }
+    }
+};
+
+#pragma endregion
+
+
+//  Queue interface used by qtree
+//  Forwards to the selected engine. Default-constructed queues use the heap engine.
+template<typename _Node, typename _Compare>
+class qqueue
+{
+    std::unique_ptr<qqueueEngine<_Node> > m_engine;
+
+public:
+    qqueue()
+    {
+        setEngine(QueueEngine::HEAP);
+    }
+
+    //  Replaces the engine. Any queued nodes are discarded.
+    void setEngine(QueueEngine engine, double bucketWidth = 1.0)
+    {
+        switch (engine)
+        {
+        case QueueEngine::CALENDAR:
+            m_engine.reset(new CalendarQueueEngine<_Node, _Compare>(bucketWidth));
+            break;
+
+        case QueueEngine::HEAP:
+        default:
+            m_engine.reset(new HeapQueueEngine<_Node, _Compare>());
+            break;
+        }
+    }
+
+    bool empty() const { return m_engine->size() == 0; }
+    size_t size() const { return m_engine->size(); }
+    _Node const & top() const { return m_engine->top(); }
+    void push(_Node const &node) { m_engine->push(node); }
+    void pop() { m_engine->pop(); }
+    void clear() { m_engine->clear(); }
+};
@@ -0,0 +1,426 @@
+#pragma once
+
+#include "qdisplaylist.h"
+#include "qtilerenderer.h"
+#include "simple_svg.hpp"
+#include "profile.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <system_error>
+#include <cstdint>
+#include <cmath>
+
+
+//  One polygon drawn on a qcanvas, as handed to its render sinks
+struct qdrawCall
+{
+    int polygon;                                // index into the display list's outline table
+    std::vector<cv::Point2f> const *outline;    // in model space
+    cv::Matx23f transform;                      // model space to pixels
+    std::vector<cv::Point2f> const *points;     // outline in pixels
+    cv::Scalar color;
+    int lineThickness;
+    cv::Scalar lineColor;
+};
+
+
+//  Output backend of a qcanvas
+//  A canvas forwards every draw to each attached sink, so a run pays only for the outputs it attaches.
+class qrenderSink
+{
+public:
+    virtual ~qrenderSink() { }
+
+    //  Sets the canvas image; sinks that draw pixels draw into it
+    virtual void create(cv::Mat im) { }
+
+    //  Starts a new drawing
+    virtual void clear() { }
+
+    virtual void draw(qdrawCall const &call) = 0;
+
+    //  Draws between beginBatch() and endBatch() may be deferred to endBatch(), which gives their line settings
+    virtual void beginBatch() { }
+    virtual void endBatch(int lineThickness, cv::Scalar lineColor) { }
+
+    //  Whether save() reads the display list, so the canvas must retain it
+    virtual bool needsDisplayList() const { return false; }
+
+    //  Writes this sink's output for {basePath}, adding its extension; false on failure
+    virtual bool save(std::filesystem::path const &basePath, qdisplayList const &displayList, cv::Matx33f const &globalTransform) { return true; }
+
+    //  "raster", "svg", "null" or "binary"; {path} is the log file of a binary sink
+    static std::shared_ptr<qrenderSink> createFromName(std::string const &name, std::filesystem::path const &path = std::filesystem::path());
+};
+
+
+//  Draws into the canvas image, and saves it as PNG
+class qrasterSink : public qrenderSink
+{
+    cv::Mat         m_image;
+    qtileRenderer   m_batch;            // polygons drawn since beginBatch()
+    bool            m_batching = false;
+
+public:
+    cv::Mat const & getImage() const { return m_image; }
+
+    void create(cv::Mat im) override { m_image = im; }
+
+    void clear() override
+    {
+        // clear image to black
+        m_image = 0;
+    }
+
+    void draw(qdrawCall const &call) override
+    {
+        if (m_batching)
+        {
+            m_batch.add(*call.points, call.color);
+            return;
+        }
+
+        PROFILE_SCOPE(FillPolyRaster);
+
+        std::vector<std::vector<cv::Point> > pts(1);
+        for (auto const& p : *call.points)
+            pts[0].push_back(p * (float)(1 << qtileRenderer::SHIFT));
+
+        qtileRenderer::drawPolygon(m_image, pts, call.color, call.lineThickness, call.lineColor);
+    }
+
+    //  Batched polygons are drawn by tile, in parallel
+    void beginBatch() override
+    {
+        m_batch.clear();
+        m_batching = true;
+    }
+
+    void endBatch(int lineThickness, cv::Scalar lineColor) override
+    {
+        m_batching = false;
+
+        PROFILE_SCOPE(FillPolyRaster);
+
+        m_batch.render(m_image, lineThickness, lineColor);
+        m_batch.clear();
+    }
+
+    bool save(std::filesystem::path const &basePath, qdisplayList const &, cv::Matx33f const &) override
+    {
+        std::filesystem::path imagePath = basePath;
+        imagePath += ".png";
+        return cv::imwrite(imagePath.string(), m_image);
+    }
+};
+
+
+//  Writes the drawing as SVG
+//  POLYGONS streams each draw to a spool file as it is drawn, so memory stays constant however many
+//  nodes are drawn; save() copies the spool and closes the copy's document, so drawing can go on.
+//  SYMBOLS defines each outline once before the nodes that use it, so it is written from the
+//  display list at save time.
+class qsvgSink : public qrenderSink
+{
+public:
+    enum class Encoding
+    {
+        POLYGONS,       // each node a <polygon> of its transformed vertices
+        SYMBOLS         // each outline defined once, each node a <use> with a matrix() transform
+    };
+
+private:
+    Encoding m_encoding;
+    int m_precision;                    // decimal places of pixel coordinates, for SYMBOLS
+    cv::Size m_size;
+
+    // POLYGONS: document of the draws since clear(), opened on the first draw
+    std::filesystem::path m_spoolPath;
+    std::unique_ptr<svg::DocumentWriter> m_spool;
+
+public:
+    qsvgSink(Encoding encoding = Encoding::POLYGONS, int precision = 2)
+        : m_encoding(encoding), m_precision(precision)
+    {
+        if (precision < 0 || precision > 9) throw std::runtime_error("Invalid SVG precision");
+
+        m_spoolPath = std::filesystem::temp_directory_path() / ("thicket-" + std::to_string(std::random_device()()) + ".svg.part");
+    }
+
+    ~qsvgSink()
+    {
+        m_spool.reset();
+        std::error_code ec;
+        std::filesystem::remove(m_spoolPath, ec);
+    }
+
+    Encoding getEncoding() const { return m_encoding; }
+    int getPrecision() const { return m_precision; }
+
+    void create(cv::Mat im) override { m_size = im.size(); }
+
+    void clear() override
+    {
+        m_spool.reset();
+    }
+
+    void draw(qdrawCall const &call) override
+    {
+        if (m_encoding != Encoding::POLYGONS)
+            return;
+
+        PROFILE_SCOPE(FillPolySvg);
+
+        if (!m_spool)
+        {
+            m_spool = openDocument(m_spoolPath);
+            if (!m_spool)
+                throw std::runtime_error("Unable to open SVG spool file " + m_spoolPath.string());
+        }
+
+        writePolygon(*m_spool, *call.points, call.color);
+    }
+
+    bool needsDisplayList() const override { return (m_encoding == Encoding::SYMBOLS); }
+
+    bool save(std::filesystem::path const &basePath, qdisplayList const &displayList, cv::Matx33f const &globalTransform) override
+    {
+        PROFILE_SCOPE(FillPolySvg);
+
+        std::filesystem::path svgPath = basePath;
+        svgPath += ".svg";
+
+        if (m_encoding == Encoding::POLYGONS && m_spool)
+        {
+            // the spool is a complete document but for the footer
+            if (!m_spool->flush())
+                return false;
+
+            std::error_code ec;
+            std::filesystem::copy_file(m_spoolPath, svgPath, std::filesystem::copy_options::overwrite_existing, ec);
+            if (ec)
+                return false;
+
+            std::ofstream file(svgPath, std::ios::app);
+            svg::writeFooter(file);
+            file.close();
+            return !file.fail();
+        }
+
+        auto doc = openDocument(svgPath);
+        if (!doc)
+            return false;
+
+        if (m_encoding == Encoding::SYMBOLS)
+            writeSymbols(*doc, displayList, globalTransform);
+
+        return doc->close();
+    }
+
+private:
+    static svg::Fill getFill(cv::Scalar const &color)
+    {
+        return svg::Fill(svg::Color((int)(0.5+color[2]), (int)(0.5+color[1]), (int)(0.5+color[0])));
+    }
+
+    //  Opens an SVG document at {path} and writes the image border and caption
+    std::unique_ptr<svg::DocumentWriter> openDocument(std::filesystem::path const &path) const
+    {
+        auto doc = std::make_unique<svg::DocumentWriter>(svg::Layout(svg::Dimensions(m_size.width, m_size.height), svg::Layout::Origin::TopLeft)); // no flip, no scale
+        if (!doc->open(path.string()))
+            return nullptr;
+
+        // draw image border
+        svg::Polygon border(svg::Stroke(1, svg::Color(55, 55, 55)));
+        border << svg::Point(0, 0) << svg::Point(m_size.width, 0)
+            << svg::Point(m_size.width, m_size.height) << svg::Point(0, m_size.height);
+        *doc << border;
+
+        *doc << svg::Text(svg::Point(5, m_size.height - 5), "Simple SVG", svg::Color(55, 55, 55), svg::Font(10, "Franklin Gothic"));
+
+        return doc;
+    }
+
+    static void writePolygon(svg::DocumentWriter &doc, std::vector<cv::Point2f> const &points, cv::Scalar const &color)
+    {
+        svg::Polygon svgPolygon(
+            getFill(color),
+            svg::Stroke()   // no outline
+        );
+        for (auto const& p : points)
+            svgPolygon << svg::Point(p.x, p.y);
+
+        doc << svgPolygon;
+    }
+
+    //  Writes each polygon once and each node as a reference to it
+    //  Digits are added to the outline coordinates for the largest scale they're drawn at, and to the
+    //  matrix's linear terms for the outline's extent, so rounding moves no vertex more than the
+    //  precision allows.
+    void writeSymbols(svg::DocumentWriter &doc, qdisplayList const &displayList, cv::Matx33f const &globalTransform) const
+    {
+        auto getExtraDigits = [](double scale) { return (scale > 1.0 ? (int)std::ceil(std::log10(scale)) : 0); };
+
+        auto const &polygons = displayList.getPolygons();
+        auto const &items = displayList.getItems();
+
+        std::vector<double> maxScales(polygons.size(), 0.0);
+        for (auto const &item : items)
+        {
+            cv::Matx23f m = (globalTransform * qdisplayList::getTransform(item)).get_minor<2, 3>(0, 0);
+            double scale = std::max({ std::abs(m(0, 0)), std::abs(m(0, 1)), std::abs(m(1, 0)), std::abs(m(1, 1)) });
+            maxScales[item.polygon] = std::max(maxScales[item.polygon], scale);
+        }
+
+        std::vector<int> linearPrecisions(polygons.size(), m_precision);
+        for (size_t i = 0; i < polygons.size(); ++i)
+        {
+            if (maxScales[i] == 0.0)
+                continue;   // unused, or drawn at zero size
+
+            svg::Symbol symbol("p" + std::to_string(i), m_precision + getExtraDigits(2.0 * maxScales[i]));
+            double extent = 0.0;
+            for (auto const &p : polygons[i])
+            {
+                symbol << svg::Point(p.x, p.y);
+                extent = std::max({ extent, (double)std::abs(p.x), (double)std::abs(p.y) });
+            }
+            doc << symbol;
+
+            linearPrecisions[i] = m_precision + getExtraDigits(2.0 * extent);
+        }
+
+        for (auto const &item : items)
+        {
+            if (maxScales[item.polygon] == 0.0)
+                continue;
+
+            cv::Matx23f m = (globalTransform * qdisplayList::getTransform(item)).get_minor<2, 3>(0, 0);
+            double const matrix[6] = { m(0, 0), m(1, 0), m(0, 1), m(1, 1), m(0, 2), m(1, 2) };
+
+            doc << svg::Use("p" + std::to_string(item.polygon), matrix, getFill(qdisplayList::getColor(item)),
+                m_precision, linearPrecisions[item.polygon]);
+        }
+    }
+};
+
+
+//  Discards everything; a canvas with only this sink measures the cost of drawing itself
+class qnullSink : public qrenderSink
+{
+public:
+    void draw(qdrawCall const &) override { }
+};
+
+
+//  Streams every draw to a compact binary node log, native byte order:
+//      header      "THKN", uint32 version, int32 width, int32 height
+//      'P' record  uint32 polygon, uint32 count, count * float[2]    outline in model space, before its first use
+//      'N' record  uint32 polygon, float[6] transform, uint8[4] color  transform is model to pixels, row-major 2x3;
+//                                                                      color is BGRA
+//  clear() restarts the log.
+class qbinarySink : public qrenderSink
+{
+    static constexpr uint32_t VERSION = 1;
+
+    std::filesystem::path m_path;
+    std::vector<char> m_buffer;
+    std::ofstream m_file;
+    cv::Size m_size;
+    int m_polygonsWritten = 0;          // outlines below this index are in the log
+
+public:
+    qbinarySink(std::filesystem::path const &path, size_t bufferSize = 1 << 20)
+        : m_path(path), m_buffer(bufferSize)
+    {
+    }
+
+    std::filesystem::path const & getPath() const { return m_path; }
+
+    void create(cv::Mat im) override { m_size = im.size(); }
+
+    void clear() override
+    {
+        if (m_file.is_open())
+            m_file.close();
+
+        // the buffer must be set before the file is opened
+        m_file.rdbuf()->pubsetbuf(m_buffer.data(), (std::streamsize)m_buffer.size());
+        m_file.open(m_path, std::ios::binary | std::ios::trunc);
+        if (!m_file) throw std::runtime_error("Unable to open node log " + m_path.string());
+
+        m_file.write("THKN", 4);
+        write(VERSION);
+        write((int32_t)m_size.width);
+        write((int32_t)m_size.height);
+
+        m_polygonsWritten = 0;
+    }
+
+    void draw(qdrawCall const &call) override
+    {
+        if (!m_file.is_open())
+            return;
+
+        // new outlines always take the next index, so every index below m_polygonsWritten is in the log
+        if (call.polygon >= m_polygonsWritten)
+        {
+            m_file.put('P');
+            write((uint32_t)call.polygon);
+            write((uint32_t)call.outline->size());
+            m_file.write(reinterpret_cast<char const *>(call.outline->data()), call.outline->size() * sizeof(cv::Point2f));
+            m_polygonsWritten = call.polygon + 1;
+        }
+
+        m_file.put('N');
+        write((uint32_t)call.polygon);
+        m_file.write(reinterpret_cast<char const *>(call.transform.val), sizeof(call.transform.val));
+        uint8_t color[4];
+        for (int i = 0; i < 4; ++i)
+            color[i] = cv::saturate_cast<uint8_t>(call.color[i]);
+        m_file.write(reinterpret_cast<char const *>(color), sizeof(color));
+    }
+
+    //  The log is already written; flushes it
+    bool save(std::filesystem::path const &, qdisplayList const &, cv::Matx33f const &) override
+    {
+        if (!m_file.is_open())
+            return false;
+
+        m_file.flush();
+        return m_file.good();
+    }
+
+private:
+    template<typename T>
+    void write(T value)
+    {
+        m_file.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+};
+
+
+inline std::shared_ptr<qrenderSink> qrenderSink::createFromName(std::string const &name, std::filesystem::path const &path)
+{
+    if (name == "raster")
+        return std::make_shared<qrasterSink>();
+    if (name == "svg")
+        return std::make_shared<qsvgSink>();
+    if (name == "null")
+        return std::make_shared<qnullSink>();
+    if (name == "binary")
+    {
+        if (path.empty()) throw std::runtime_error("Binary render sink needs a log path");
+        return std::make_shared<qbinarySink>(path);
+    }
+
+    throw std::runtime_error("Unknown render sink: " + name);
+}
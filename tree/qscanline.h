@@ -0,0 +1,184 @@
+#pragma once
+
+#include "qbitfield.h"
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+
+//  Scanline polygon rasterizer for collision masks
+//  Produces the same cells as drawing an integer polygon with cv::fillPoly(LINE_8) and then erasing
+//  its outline with cv::polylines(LINE_8): fillPoly's spans, evaluated in the same 16.16 fixed point,
+//  minus the 8-connected Bresenham outline of each edge. The mask is built row by row, and each
+//  completed row can be tested against a field, so a blocked candidate stops at its first overlap.
+class qscanline
+{
+    static const int XY_SHIFT = 16;
+    static const int64_t XY_ONE = (int64_t)1 << XY_SHIFT;
+
+    struct Edge
+    {
+        int y0, y1;         // active for y0 <= y < y1
+        int64_t x, dx;      // fixed point
+    };
+
+    // scratch, reused across calls on each thread
+    struct Scratch
+    {
+        std::vector<Edge> edges;
+        std::vector<Edge> active;
+        std::vector<cv::Point> outline;
+        std::vector<int> outlineRows;   // outline index ranges by row
+    };
+
+public:
+    //  Rasterizes {pts} (field coordinates) into {mask}, which covers {rect}, the points' bounding rect.
+    //  If {field} is given, each row is tested as it is completed and the function returns true at the
+    //  first overlap, leaving the rest of the mask unfinished. Otherwise it returns false.
+    static bool rasterize(std::vector<cv::Point> const &pts, cv::Rect const &rect, qbitmask &mask, qbitfield const *field = nullptr)
+    {
+        thread_local Scratch scratch;
+
+        mask.create(rect);
+        if (pts.size() < 2 || rect.area() == 0)
+            return false;
+
+        collectOutline(pts, rect, scratch);
+        collectEdges(pts, rect, scratch);
+
+        auto &edges = scratch.edges;
+        auto &active = scratch.active;
+        active.clear();
+
+        size_t next = 0;
+        for (int y = 0; y < rect.height; ++y)
+        {
+            // update active edges, kept sorted by x
+            active.erase(std::remove_if(active.begin(), active.end(), [y](Edge const &e) { return e.y1 == y; }), active.end());
+            for (; next < edges.size() && edges[next].y0 == y; ++next)
+                active.push_back(edges[next]);
+            std::sort(active.begin(), active.end(), [](Edge const &a, Edge const &b) { return a.x < b.x; });
+
+            // even-odd spans, inclusive of both ends
+            for (size_t i = 0; i + 1 < active.size(); i += 2)
+            {
+                int x0 = (int)((active[i].x + XY_ONE - 1) >> XY_SHIFT);
+                int x1 = (int)(active[i + 1].x >> XY_SHIFT);
+                x0 = std::max(x0, 0);
+                x1 = std::min(x1, rect.width - 1);
+                if (x0 <= x1)
+                    mask.setSpan(y, x0, x1);
+            }
+            for (auto &e : active)
+                e.x += e.dx;
+
+            // shave the outline
+            for (int i = scratch.outlineRows[y]; i < scratch.outlineRows[y + 1]; ++i)
+                mask.reset(y, scratch.outline[i].x);
+
+            if (field && field->intersectsRow(mask, y))
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    //  Edges in mask coordinates, sorted by starting row. Horizontal edges are dropped.
+    static void collectEdges(std::vector<cv::Point> const &pts, cv::Rect const &rect, Scratch &scratch)
+    {
+        auto &edges = scratch.edges;
+        edges.clear();
+
+        cv::Point p0 = pts.back() - rect.tl();
+        for (auto const &pt : pts)
+        {
+            cv::Point p1 = pt - rect.tl();
+            if (p0.y != p1.y)
+            {
+                cv::Point top = (p0.y < p1.y ? p0 : p1);
+                cv::Point bottom = (p0.y < p1.y ? p1 : p0);
+                Edge e;
+                e.y0 = top.y;
+                e.y1 = bottom.y;
+                e.dx = (((int64_t)bottom.x - top.x) << XY_SHIFT) / (bottom.y - top.y);
+                e.x = ((int64_t)top.x << XY_SHIFT);
+                edges.push_back(e);
+            }
+            p0 = p1;
+        }
+
+        std::sort(edges.begin(), edges.end(), [](Edge const &a, Edge const &b) { return a.y0 < b.y0; });
+    }
+
+    //  8-connected outline in mask coordinates, bucketed by row
+    static void collectOutline(std::vector<cv::Point> const &pts, cv::Rect const &rect, Scratch &scratch)
+    {
+        auto &outline = scratch.outline;
+        outline.clear();
+
+        cv::Point p0 = pts.back() - rect.tl();
+        for (auto const &pt : pts)
+        {
+            cv::Point p1 = pt - rect.tl();
+            appendLine(p0, p1, outline);
+            p0 = p1;
+        }
+
+        // counting sort by row
+        auto &rows = scratch.outlineRows;
+        rows.assign(rect.height + 1, 0);
+        for (auto const &p : outline)
+            rows[p.y + 1]++;
+        for (int y = 0; y < rect.height; ++y)
+            rows[y + 1] += rows[y];
+
+        thread_local std::vector<cv::Point> sorted;
+        thread_local std::vector<int> fill;
+        sorted.resize(outline.size());
+        fill.assign(rows.begin(), rows.end() - 1);
+        for (auto const &p : outline)
+            sorted[fill[p.y]++] = p;
+        outline.swap(sorted);
+    }
+
+    //  Bresenham line, stepping as cv::LineIterator does for 8-connectivity: drawn left to right,
+    //  with a minor-axis step whenever the error term is negative
+    static void appendLine(cv::Point p0, cv::Point p1, std::vector<cv::Point> &points)
+    {
+        if (p1.x < p0.x)
+            std::swap(p0, p1);
+
+        int dx = p1.x - p0.x;
+        int dy = p1.y - p0.y;
+        int sy = (dy < 0 ? -1 : 1);
+        dy = std::abs(dy);
+
+        bool yMajor = (dy > dx);
+        int major = (yMajor ? dy : dx);
+        int minor = (yMajor ? dx : dy);
+
+        int err = major - (minor + minor);
+        cv::Point p = p0;
+        for (int i = 0; i <= major; ++i)
+        {
+            points.push_back(p);
+
+            bool step = (err < 0);
+            err += -(minor + minor) + (step ? major + major : 0);
+            if (yMajor)
+            {
+                p.y += sy;
+                if (step)
+                    p.x++;
+            }
+            else
+            {
+                p.x++;
+                if (step)
+                    p.y += sy;
+            }
+        }
+    }
+};
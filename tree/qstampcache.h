@@ -0,0 +1,255 @@
+#pragma once
+
+#include "qbitfield.h"
+#include "qscanline.h"
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+
+//  Cache of rasterized collision masks
+//  A mask depends only on the field polygon relative to its bounding rect: the rasterizer works on
+//  integer points, so translating a polygon by whole cells translates its mask exactly. Nodes that
+//  differ only by translation (grids, edge-mapped regular polygons, equal-scale thorns) share an entry.
+//  Entries are stored as row spans, so a hit can be drawn at any bit offset and tested row by row.
+//  Memory is bounded: each shard evicts its least recently used entries. Safe for concurrent use.
+class qstampCache
+{
+public:
+    //  A rasterized mask as spans of set cells, relative to its bounding rect
+    struct Stamp
+    {
+        cv::Size size;
+        std::vector<int> rowStart;                  // span index ranges by row
+        std::vector<std::pair<int, int> > spans;    // inclusive [x0, x1]
+
+        size_t getMemorySize() const
+        {
+            return sizeof(Stamp) + rowStart.size() * sizeof(int) + spans.size() * sizeof(spans[0]);
+        }
+
+        //  Builds the spans of {mask}
+        void fromMask(qbitmask const &mask)
+        {
+            size = mask.rect.size();
+            rowStart.assign(1, 0);
+            spans.clear();
+
+            int bitOffset = mask.getBitOffset();
+            int totalBits = mask.stride * 64;
+            for (int y = 0; y < size.height; ++y)
+            {
+                int bit = bitOffset;
+                while (bit < totalBits)
+                {
+                    // find the next set bit, then the next clear bit
+                    int b0 = findBit(mask, y, bit, totalBits, true);
+                    if (b0 >= totalBits)
+                        break;
+                    int b1 = findBit(mask, y, b0, totalBits, false);
+                    spans.push_back(std::make_pair(b0 - bitOffset, b1 - 1 - bitOffset));
+                    bit = b1;
+                }
+                rowStart.push_back((int)spans.size());
+            }
+        }
+
+        //  Draws the stamp into {mask} at {rect}. If {field} is given, each row is tested as it is
+        //  drawn and the function returns true at the first overlap.
+        bool draw(cv::Rect const &rect, qbitmask &mask, qbitfield const *field = nullptr) const
+        {
+            mask.create(rect);
+            for (int y = 0; y < size.height; ++y)
+            {
+                for (int i = rowStart[y]; i < rowStart[y + 1]; ++i)
+                    mask.setSpan(y, spans[i].first, spans[i].second);
+
+                if (field && rowStart[y + 1] > rowStart[y] && field->intersectsRow(mask, y))
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        static int findBit(qbitmask const &mask, int y, int bit, int totalBits, bool value)
+        {
+            while (bit < totalBits)
+            {
+                uint64_t word = mask.getWord(y, bit >> 6);
+                word = (value ? word : ~word) >> (bit & 63);
+                if (word)
+                    return std::min(totalBits, bit + std::countr_zero(word));
+                bit = ((bit >> 6) + 1) << 6;
+            }
+            return totalBits;
+        }
+    };
+
+    struct Stats
+    {
+        long long hits = 0;
+        long long misses = 0;
+        long long evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+
+        double getHitRate() const { return (hits + misses ? (double)hits / (hits + misses) : 0.0); }
+    };
+
+private:
+    typedef std::vector<cv::Point> Key;
+
+    struct KeyHash
+    {
+        size_t operator()(Key const &key) const
+        {
+            uint64_t h = 14695981039346656037ull;
+            for (auto const &p : key)
+            {
+                h = (h ^ (uint32_t)p.x) * 1099511628211ull;
+                h = (h ^ (uint32_t)p.y) * 1099511628211ull;
+            }
+            return (size_t)h;
+        }
+    };
+
+    static const int SHARD_COUNT = 16;
+
+    struct Shard
+    {
+        typedef std::list<std::pair<Key, std::shared_ptr<Stamp const> > > LruList;
+
+        mutable std::mutex mutex;
+        LruList lru;            // most recently used first
+        std::unordered_map<Key, LruList::iterator, KeyHash> index;
+        size_t bytes = 0;
+    };
+
+    Shard m_shards[SHARD_COUNT];
+    size_t m_maxBytes = 0;
+
+    std::atomic<long long> m_hits{ 0 };
+    std::atomic<long long> m_misses{ 0 };
+    std::atomic<long long> m_evictions{ 0 };
+
+public:
+    qstampCache(size_t maxBytes = 0) : m_maxBytes(maxBytes) { }
+
+    //  0 disables the cache
+    void setMaxBytes(size_t maxBytes)
+    {
+        m_maxBytes = maxBytes;
+        clear();
+    }
+
+    size_t getMaxBytes() const { return m_maxBytes; }
+
+    bool isEnabled() const { return m_maxBytes > 0; }
+
+    void clear()
+    {
+        for (auto &shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.lru.clear();
+            shard.index.clear();
+            shard.bytes = 0;
+        }
+        m_hits = 0;
+        m_misses = 0;
+        m_evictions = 0;
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.hits = m_hits;
+        stats.misses = m_misses;
+        stats.evictions = m_evictions;
+        for (auto &shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.entries += shard.index.size();
+            stats.bytes += shard.bytes;
+        }
+        return stats;
+    }
+
+    //  Draws the mask of field polygon {pts}, with bounding rect {rect}, into {mask}: from the cache
+    //  if possible, otherwise by rasterizing it. If {field} is given, returns true if the mask overlaps
+    //  it; a blocked mask may be left unfinished. Misses keep the rasterizer's early exit, so only
+    //  masks that were completed, i.e. that didn't overlap {field}, are cached.
+    bool draw(std::vector<cv::Point> const &pts, cv::Rect const &rect, qbitmask &mask, qbitfield const *field = nullptr)
+    {
+        if (!isEnabled())
+            return qscanline::rasterize(pts, rect, mask, field);
+
+        Key key(pts.size());
+        for (size_t i = 0; i < pts.size(); ++i)
+            key[i] = pts[i] - rect.tl();
+
+        size_t hash = KeyHash()(key);
+        Shard &shard = m_shards[hash % SHARD_COUNT];
+
+        std::shared_ptr<Stamp const> stamp;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                stamp = it->second->second;
+            }
+        }
+
+        if (stamp)
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return stamp->draw(rect, mask, field);
+        }
+
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+
+        // most misses are blocked candidates, which stop at the first overlapping row and aren't cached
+        if (qscanline::rasterize(pts, rect, mask, field))
+            return true;
+
+        auto newStamp = std::make_shared<Stamp>();
+        newStamp->fromMask(mask);
+        insert(shard, std::move(key), newStamp);
+
+        return false;
+    }
+
+private:
+    void insert(Shard &shard, Key &&key, std::shared_ptr<Stamp const> stamp)
+    {
+        size_t entryBytes = stamp->getMemorySize() + key.size() * sizeof(cv::Point);
+        size_t maxShardBytes = m_maxBytes / SHARD_COUNT;
+        if (entryBytes > maxShardBytes)
+            return;
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.index.find(key) != shard.index.end())
+            return;     // inserted by another thread meanwhile
+
+        while (!shard.lru.empty() && shard.bytes + entryBytes > maxShardBytes)
+        {
+            auto &victim = shard.lru.back();
+            shard.bytes -= victim.second->getMemorySize() + victim.first.size() * sizeof(cv::Point);
+            shard.index.erase(victim.first);
+            shard.lru.pop_back();
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        shard.lru.emplace_front(key, stamp);
+        shard.index.emplace(std::move(key), shard.lru.begin());
+        shard.bytes += entryBytes;
+    }
+};
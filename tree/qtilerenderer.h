@@ -0,0 +1,204 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <algorithm>
+
+
+//  Rasterizes a list of polygons into an image by screen tile, tiles in parallel
+//  Each polygon is binned into the tiles its bounding box touches, in list order, so every tile paints
+//  its polygons in the same order as a serial painter. Tiles are drawn into a scratch buffer padded by
+//  {margin}; polygons that don't fit inside the padding of every tile they touch would be clipped there,
+//  which shifts antialiased edges, so they are drawn on the full image between runs of tiled polygons.
+//  The result is pixel-identical to drawing the list serially.
+class qtileRenderer
+{
+public:
+    static constexpr int SHIFT = 4;     // fractional bits of polygon coordinates
+
+    int tileSize = 128;
+    int margin = 64;
+
+private:
+    std::vector<cv::Point> m_points;    // all polygons, in 1/16 pixel fixed point
+    std::vector<size_t> m_offsets{ 0 }; // start of each polygon in m_points, plus end
+    std::vector<cv::Scalar> m_colors;
+
+public:
+    void clear()
+    {
+        m_points.clear();
+        m_offsets.assign(1, 0);
+        m_colors.clear();
+    }
+
+    bool empty() const { return m_colors.empty(); }
+    size_t size() const { return m_colors.size(); }
+
+    //  Adds polygon {v} in image coordinates
+    void add(std::vector<cv::Point2f> const &v, cv::Scalar color)
+    {
+        for (auto const &p : v)
+            m_points.push_back(p * (float)(1 << SHIFT));
+        m_offsets.push_back(m_points.size());
+        m_colors.push_back(color);
+    }
+
+    //  Draws one polygon in fixed point, as qcanvas always has
+    static void drawPolygon(cv::Mat &image, std::vector<std::vector<cv::Point> > const &pts, cv::Scalar color, int lineThickness, cv::Scalar lineColor)
+    {
+        if (lineThickness > 0)
+        {
+            cv::fillPoly(image, pts, color, cv::LineTypes::LINE_8, SHIFT);
+            cv::polylines(image, pts, true, lineColor, lineThickness, cv::LineTypes::LINE_AA, SHIFT);
+        }
+        else
+        {
+            cv::fillPoly(image, pts, color, cv::LineTypes::LINE_AA, SHIFT);
+        }
+    }
+
+    void render(cv::Mat &image, int lineThickness, cv::Scalar lineColor) const
+    {
+        if (empty() || image.empty())
+            return;
+
+        cv::Rect imageRect(0, 0, image.cols, image.rows);
+        int cols = (image.cols + tileSize - 1) / tileSize;
+        int rows = (image.rows + tileSize - 1) / tileSize;
+
+        // bounds are widened for antialiasing and outlines
+        int slack = lineThickness + 2;
+
+        std::vector<std::vector<int> > bins((size_t)cols * rows);
+        std::vector<std::vector<cv::Point> > pts(1);
+        bool pending = false;
+
+        for (int i = 0; i < (int)m_colors.size(); ++i)
+        {
+            if (m_offsets[i] == m_offsets[i + 1])
+                continue;
+
+            cv::Point lo = m_points[m_offsets[i]];
+            cv::Point hi = lo;
+            for (size_t j = m_offsets[i] + 1; j < m_offsets[i + 1]; ++j)
+            {
+                lo.x = std::min(lo.x, m_points[j].x);
+                lo.y = std::min(lo.y, m_points[j].y);
+                hi.x = std::max(hi.x, m_points[j].x);
+                hi.y = std::max(hi.y, m_points[j].y);
+            }
+
+            cv::Rect rc(
+                cv::Point((lo.x >> SHIFT) - slack, (lo.y >> SHIFT) - slack),
+                cv::Point((hi.x >> SHIFT) + slack + 1, (hi.y >> SHIFT) + slack + 1));
+            rc &= imageRect;
+            if (rc.area() == 0)
+                continue;
+
+            int tx0 = rc.x / tileSize;
+            int ty0 = rc.y / tileSize;
+            int tx1 = (rc.x + rc.width - 1) / tileSize;
+            int ty1 = (rc.y + rc.height - 1) / tileSize;
+
+            // must fit the padding of both the first and last tile in each direction
+            cv::Rect first = getPaddedRect(tx0, ty0, imageRect);
+            cv::Rect last = getPaddedRect(tx1, ty1, imageRect);
+            if (rc.x < last.x || rc.y < last.y || rc.br().x > first.br().x || rc.br().y > first.br().y)
+            {
+                if (pending)
+                    renderTiles(image, bins, cols, lineThickness, lineColor);
+                pending = false;
+
+                getPolygon(i, cv::Point(0, 0), pts[0]);
+                drawPolygon(image, pts, m_colors[i], lineThickness, lineColor);
+                continue;
+            }
+
+            for (int ty = ty0; ty <= ty1; ++ty)
+                for (int tx = tx0; tx <= tx1; ++tx)
+                    bins[(size_t)ty * cols + tx].push_back(i);
+            pending = true;
+        }
+
+        if (pending)
+            renderTiles(image, bins, cols, lineThickness, lineColor);
+    }
+
+private:
+    cv::Rect getTileRect(int tx, int ty, cv::Rect const &imageRect) const
+    {
+        return cv::Rect(tx * tileSize, ty * tileSize, tileSize, tileSize) & imageRect;
+    }
+
+    cv::Rect getPaddedRect(int tx, int ty, cv::Rect const &imageRect) const
+    {
+        return cv::Rect(tx * tileSize - margin, ty * tileSize - margin, tileSize + 2 * margin, tileSize + 2 * margin) & imageRect;
+    }
+
+    //  Polygon {i} in fixed point, relative to pixel {origin}
+    void getPolygon(int i, cv::Point origin, std::vector<cv::Point> &pts) const
+    {
+        pts.assign(m_points.begin() + m_offsets[i], m_points.begin() + m_offsets[i + 1]);
+        if (origin != cv::Point(0, 0))
+        {
+            origin *= (1 << SHIFT);
+            for (auto &p : pts)
+                p -= origin;
+        }
+    }
+
+    //  Draws and empties {bins}
+    void renderTiles(cv::Mat &image, std::vector<std::vector<int> > &bins, int cols, int lineThickness, cv::Scalar lineColor) const
+    {
+        class TileBody : public cv::ParallelLoopBody
+        {
+            qtileRenderer const &renderer;
+            std::vector<std::vector<int> > const &bins;
+            cv::Mat &image;
+            int cols;
+            int lineThickness;
+            cv::Scalar lineColor;
+        public:
+            TileBody(qtileRenderer const &renderer_, std::vector<std::vector<int> > const &bins_, cv::Mat &image_, int cols_, int lineThickness_, cv::Scalar lineColor_)
+                : renderer(renderer_), bins(bins_), image(image_), cols(cols_), lineThickness(lineThickness_), lineColor(lineColor_) { }
+
+            virtual void operator()(cv::Range const &range) const override
+            {
+                cv::Rect imageRect(0, 0, image.cols, image.rows);
+                std::vector<std::vector<cv::Point> > pts(1);
+                cv::Mat scratch;
+
+                for (int t = range.start; t < range.end; ++t)
+                {
+                    if (bins[t].empty())
+                        continue;
+
+                    cv::Rect tile = renderer.getTileRect(t % cols, t / cols, imageRect);
+                    cv::Rect padded = renderer.getPaddedRect(t % cols, t / cols, imageRect);
+                    cv::Rect inner = tile - padded.tl();
+
+                    // only the tile itself is read and written back, so neighboring tiles never race
+                    scratch.create(padded.size(), image.type());
+                    scratch = cv::Scalar::all(0);
+                    image(tile).copyTo(scratch(inner));
+
+                    for (int i : bins[t])
+                    {
+                        renderer.getPolygon(i, padded.tl(), pts[0]);
+                        drawPolygon(scratch, pts, renderer.m_colors[i], lineThickness, lineColor);
+                    }
+
+                    scratch(inner).copyTo(image(tile));
+                }
+            }
+        };
+
+        cv::parallel_for_(cv::Range(0, (int)bins.size()), TileBody(*this, bins, image, cols, lineThickness, lineColor));
+
+        for (auto &bin : bins)
+            bin.clear();
+    }
+};
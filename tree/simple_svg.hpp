@@ -37,6 +37,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <charconv>
+#include <algorithm>
 
 #include <iostream>
 
@@ -64,6 +66,31 @@ namespace svg
         return "/>\n";
     }
 
+    // Writes {value} with at most {precision} decimal places, trailing zeros dropped.
+    inline void numberToStream(std::ostream & ss, double value, int precision)
+    {
+        char buf[64];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+        if (result.ec != std::errc())
+        {
+            ss << value;
+            return;
+        }
+
+        char * end = result.ptr;
+        if (precision > 0)
+        {
+            while (end[-1] == '0')
+                --end;
+            if (end[-1] == '.')
+                --end;
+        }
+        char * begin = buf;
+        if (end - begin == 2 && begin[0] == '-' && begin[1] == '0')
+            ++begin;    // "-0"
+        ss.write(begin, end - begin);
+    }
+
     // Quick optional return type.  This allows functions to return an invalid
     //  value if no good return is possible.  The user checks for validity
     //  before using the returned value.
@@ -71,9 +98,9 @@ namespace svg
     class optional
     {
     public:
-        optional<T>(T const & type)
+        optional(T const & type)
             : valid(true), type(type) { }
-        optional<T>() : valid(false), type(T()) { }
+        optional() : valid(false), type(T()) { }
         T * operator->()
         {
             // If we try to access an invalid value, an exception is thrown.
@@ -471,6 +498,78 @@ namespace svg
         std::vector<Point> points;
     };
 
+    // Closed outline defined once, in <defs>, to be drawn any number of times by Use.
+    // Coordinates are in the symbol's own space and not translated by the layout.
+    class Symbol : public Shape
+    {
+    public:
+        Symbol(std::string const & id, int precision = 3)
+            : id(id), precision(precision) { }
+        Symbol & operator<<(Point const & point)
+        {
+            points.push_back(point);
+            return *this;
+        }
+        void toStream(std::ostream & ss, Layout const &) const
+        {
+            ss << "\t<defs><path " << attribute("id", id) << "d=\"";
+            for (unsigned i = 0; i < points.size(); ++i)
+            {
+                ss << (i == 0 ? 'M' : 'L');
+                numberToStream(ss, points[i].x, precision);
+                ss << ' ';
+                numberToStream(ss, points[i].y, precision);
+            }
+            ss << "Z\" " << emptyElemEnd() << "\t</defs>\n";
+        }
+        void offset(Point const & offset)
+        {
+            for (unsigned i = 0; i < points.size(); ++i) {
+                points[i].x += offset.x;
+                points[i].y += offset.y;
+            }
+        }
+    private:
+        std::string id;
+        int precision;
+        std::vector<Point> points;
+    };
+
+    // Instance of a Symbol, mapped by the affine matrix(a b c d e f):
+    //  x' = a x + c y + e,  y' = b x + d y + f
+    // The matrix maps straight to document space; the layout is not applied.
+    // {precision} is for the translation, {linearPrecision} for the other four terms.
+    class Use : public Shape
+    {
+    public:
+        Use(std::string const & id, double const (&matrix)[6], Fill const & fill = Fill(), int precision = 2, int linearPrecision = 4)
+            : Shape(fill), id(id), precision(precision), linearPrecision(linearPrecision)
+        {
+            std::copy(matrix, matrix + 6, this->matrix);
+        }
+        void toStream(std::ostream & ss, Layout const & layout) const
+        {
+            ss << elemStart("use") << "xlink:href=\"#" << id << "\" transform=\"matrix(";
+            for (int i = 0; i < 6; ++i)
+            {
+                if (i > 0)
+                    ss << ' ';
+                numberToStream(ss, matrix[i], (i < 4 ? linearPrecision : precision));
+            }
+            ss << ")\" " << fill.toString(layout) << emptyElemEnd();
+        }
+        void offset(Point const & offset)
+        {
+            matrix[4] += offset.x;
+            matrix[5] += offset.y;
+        }
+    private:
+        std::string id;
+        double matrix[6];
+        int precision;
+        int linearPrecision;
+    };
+
     class Text : public Shape
     {
     public:
@@ -581,6 +680,23 @@ namespace svg
         }
     };
 
+    inline void writeHeader(std::ostream &ss, Layout const &layout)
+    {
+        ss << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
+            << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
+            << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
+            << attribute("width",  layout.dimensions.width,  "px")
+            << attribute("height", layout.dimensions.height, "px")
+            << attribute("xmlns", "http://www.w3.org/2000/svg")
+            << attribute("xmlns:xlink", "http://www.w3.org/1999/xlink")
+            << attribute("version", "1.1") << ">\n";
+    }
+
+    inline void writeFooter(std::ostream &ss)
+    {
+        ss << elemEnd("svg");
+    }
+
     class Document
     {
     public:
@@ -620,17 +736,68 @@ namespace svg
 
     inline std::ostream& operator << (std::ostream &ss, Document const &doc)
     {
-        ss << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
-            << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
-            << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
-            << attribute("width",  doc.layout.dimensions.width,  "px")
-            << attribute("height", doc.layout.dimensions.height, "px")
-            << attribute("xmlns", "http://www.w3.org/2000/svg")
-            << attribute("version", "1.1") << ">\n" 
-            << doc.body_nodes_str.str()
-            << elemEnd("svg");
+        writeHeader(ss, doc.layout);
+        ss << doc.body_nodes_str.str();
+        writeFooter(ss);
         return ss;
     }
+
+    // Document that writes each shape straight to its file as it is added,
+    // so memory use is just the write buffer however large the drawing gets.
+    class DocumentWriter
+    {
+    public:
+        DocumentWriter(Layout const & layout = Layout(Dimensions(-1,-1)), size_t buffer_size = 1 << 20)
+            : layout(layout), buffer(buffer_size) { }
+
+        ~DocumentWriter() { close(); }
+
+        DocumentWriter(DocumentWriter const &) = delete;
+        DocumentWriter & operator=(DocumentWriter const &) = delete;
+
+        bool open(std::string file_name)
+        {
+            // the buffer must be set before the file is opened
+            ofs.rdbuf()->pubsetbuf(buffer.data(), (std::streamsize)buffer.size());
+            ofs.open(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            writeHeader(ofs, layout);
+            return true;
+        }
+
+        bool is_open() const { return ofs.is_open(); }
+
+        DocumentWriter & operator<<(Shape const & shape)
+        {
+            shape.toStream(ofs, layout);
+            return *this;
+        }
+
+        // Writes everything added so far to the file, which lacks only the footer; false if any write failed
+        bool flush()
+        {
+            ofs.flush();
+            return ofs.good();
+        }
+
+        // Writes the footer and closes the file; false if any write failed
+        bool close()
+        {
+            if (!ofs.is_open())
+                return false;
+
+            writeFooter(ofs);
+            ofs.close();
+            return !ofs.fail();
+        }
+    private:
+        Layout layout;
+
+        std::vector<char> buffer;
+        std::ofstream ofs;
+    };
 }
 
 #endif
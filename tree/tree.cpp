@@ -1,7 +1,12 @@
 #include "tree.h"
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <fstream>
+#include <iomanip>
 #include <vector>
+#include <limits>
+#include <algorithm>
 
 
 #pragma region qnode tree
@@ -10,32 +15,184 @@
 //  process one node
 bool qtree::process()
 {
-    auto currentNode = nodeQueue.top();
-    nodeQueue.pop();
+    qcandidate candidate(peekNode());
+    popNode();
 
-    if (!isViable(currentNode))
+    if (!evaluate(candidate))
         return false;
 
-    addNode(currentNode);
+    commit(candidate);
 
-    // create a child node for each available transform.
-    // all child nodes are added to the queue, even if not viable.
+    return true;
+}
+
+
+//  process a batch of nodes
+//  the base implementation is serial; extending classes may evaluate the batch concurrently
+int qtree::processBatch(int maxNodes, std::vector<qnode> *committed, int *popped)
+{
+    int nodesAdded = 0;
+    int nodesPopped = 0;
+    while (nodesPopped < maxNodes && !isQueueEmpty())
+    {
+        qcandidate candidate(peekNode());
+        popNode();
+        nodesPopped++;
+
+        if (!evaluate(candidate))
+            continue;
+
+        commit(candidate);
+
+        nodesAdded++;
+        if (committed)
+            committed->push_back(candidate.node);
+    }
+
+    if (popped)
+        *popped = nodesPopped;
+    return nodesAdded;
+}
+
+
+qnode const & qtree::peekNode()
+{
+    if (!isPendingFirst())
+        return nodeQueue.top();
+
+    if (!m_pendingTopValid)
+    {
+        auto const &pending = pendingQueue.top();
+        auto const &parent = lazyParents[pending.parentSlot];
+        m_pendingTop.id = pending.id;
+        m_pendingTop.beginTime = pending.beginTime;
+        materialize(parent.node, transforms[pending.id - parent.firstChildId], m_pendingTop);
+        m_pendingTopValid = true;
+    }
+
+    return m_pendingTop;
+}
+
+
+void qtree::popNode()
+{
+    PROFILE_SCOPE(QueuePop);
+
+    if (isPendingFirst())
+    {
+        int slot = pendingQueue.top().parentSlot;
+        pendingQueue.pop();
+        m_pendingTopValid = false;
+
+        if (--lazyParents[slot].pendingChildren == 0)
+            lazyFreeSlots.push_back(slot);
+    }
+    else
+    {
+        nodeQueue.pop();
+    }
+}
+
+
+void qtree::popBatch(int maxNodes, std::vector<qnode> & batch)
+{
+    batch.clear();
+    if (isQueueEmpty() || maxNodes < 1)
+        return;
+
+    // children are due no sooner than minGestation after their parent, and tie-break after all
+    // nodes already queued, so nodes due by then are unaffected by anything this batch commits
+    double minGestation = std::numeric_limits<double>::infinity();
     for (auto const &t : transforms)
+        minGestation = std::min(minGestation, t.gestation);
+
+    double horizon = peekNode().beginTime + minGestation;
+
+    while ((int)batch.size() < maxNodes && !isQueueEmpty())
+    {
+        auto const &node = peekNode();
+        if (!batch.empty() && !(node.beginTime <= horizon))
+            break;
+        batch.push_back(node);
+        popNode();
+    }
+}
+
+
+void qtree::flushLazyChildren()
+{
+    while (!pendingQueue.empty())
     {
+        auto const &pending = pendingQueue.top();
+        auto const &parent = lazyParents[pending.parentSlot];
+
         qnode child;
-        beget(currentNode, t, child);
-        assert(currentNode.id == 0 || currentNode.parentId < currentNode.id);
+        child.id = pending.id;
+        child.beginTime = pending.beginTime;
+        materialize(parent.node, transforms[pending.id - parent.firstChildId], child);
         nodeQueue.push(child);
+
+        pendingQueue.pop();
     }
 
-    return true;
+    lazyParents.clear();
+    lazyFreeSlots.clear();
+    m_pendingTopValid = false;
+}
+
+
+//  create a child node for each available transform.
+//  all child nodes are added to the queue, even if not viable.
+void qtree::pushChildren(qnode const & parent)
+{
+    if (lazyChildren)
+    {
+        if (transforms.empty())
+            return;
+
+        // only ids and begin times are assigned now, in the same order as eager mode, so the ids and
+        // random sequence match; both queues break ties by id, so the pop order matches too
+        int slot;
+        if (lazyFreeSlots.empty())
+        {
+            slot = (int)lazyParents.size();
+            lazyParents.emplace_back();
+        }
+        else
+        {
+            slot = lazyFreeSlots.back();
+            lazyFreeSlots.pop_back();
+        }
+        lazyParents[slot] = qlazyParent{ parent, nextNodeId, (int)transforms.size() };
+
+        for (auto const &t : transforms)
+        {
+            pendingQueue.push(qpending{ getChildBeginTime(parent, t), slot, nextNodeId++ });
+        }
+
+        // a new child may now be first; the materialized top is rebuilt with the same id
+        m_pendingTopValid = false;
+        return;
+    }
+
+    for (auto const &t : transforms)
+    {
+        qnode child;
+        beget(parent, t, child);
+        assert(child.parentId < child.id);
+        nodeQueue.push(child);
+    }
 }
 
 
 void qtree::addNode(qnode & node)
 {
-    if(!node.sourceTransform.empty())
-        transformCounts[node.sourceTransform]++;
+    if (node.transformId >= 0)
+    {
+        if (node.transformId >= (int)transformCounts.size())
+            transformCounts.resize(transformKeys.size());
+        transformCounts[node.transformId]++;
+    }
 }
 
 
@@ -43,14 +200,27 @@ void qtree::addNode(qnode & node)
 void qtree::beget(qnode const & parent, qtransform const & t, qnode & child)
 {
     child.id = nextNodeId++;
-    child.parentId = parent.id;
-    child.sourceTransform = t.transformMatrixKey;
+    child.beginTime = getChildBeginTime(parent, t);
+    materialize(parent, t, child);
+}
 
-    child.beginTime = parent.beginTime + t.gestation + (gestationRandomness>0.0 ? r(gestationRandomness) : 0.0);
+
+double qtree::getChildBeginTime(qnode const & parent, qtransform const & t)
+{
+    return parent.beginTime + t.gestation + (gestationRandomness>0.0 ? r(gestationRandomness) : 0.0);
+}
+
+
+void qtree::materialize(qnode const & parent, qtransform const & t, qnode & child)
+{
+    PROFILE_SCOPE(Beget);
+
+    child.parentId = parent.id;
+    child.transformId = getTransformId(t);
 
     child.globalTransform = parent.globalTransform * t.transformMatrix;
 
-    child.color = t.colorTransform.apply(parent.color);
+    child.setColor(t.colorTransform.apply(parent.getColor()));
 }
 
 
@@ -58,12 +228,42 @@ void qtree::beget(qnode const & parent, qtransform const & t, qnode & child)
 void qtree::drawNode(qcanvas &canvas, qnode const &node)
 {
     cv::Scalar color =
-        //(node.det() < 0) ? 255.0 * (cv::Scalar(1.0, 1.0, 1.0, 1.0) - node.color) : 
-        255.0 * node.color;
+        //(node.det() < 0) ? 255.0 * (cv::Scalar(1.0, 1.0, 1.0, 1.0) - node.getColor()) : 
+        255.0 * node.getColor();
 
-    canvas.fillPoly(polygon, node.globalTransform, 255.0 * node.color, lineThickness, lineColor);
+    canvas.fillPoly(polygon, node.getTransform(), color, lineThickness, lineColor);
 }
 
 
 #pragma endregion
 
+
+#pragma region Output
+
+void qtree::saveOutputs(fs::path const &basePath, qcanvas const &canvas)
+{
+    // Write each render sink's output: PNG, SVG, node log
+
+    if (!canvas.save(basePath))
+        std::cerr << "Unable to write all outputs for " << basePath << endl;
+
+    fs::path imagePath = basePath;
+    imagePath += ".png";
+
+    if (name.empty())
+    {
+        name = basePath.filename().string();
+    }
+
+    // allow extending classes to customize the save
+    saveImage(imagePath, canvas);
+
+    // save the settings too
+    std::ofstream outfile(fs::path(imagePath).replace_extension("settings.json"));
+    json j;
+    to_json(j);
+    outfile << std::setw(4) << j;
+}
+
+#pragma endregion
+
@@ -3,6 +3,10 @@
 #include "ColorTransform.h"
 #include "util.h"
 #include "simple_svg.hpp"
+#include "qqueue.h"
+#include "qbitfield.h"
+#include "qrendersink.h"
+#include "profile.h"
 #include <opencv2/core/core.hpp>
 #include <vector>
 #include <queue>
@@ -12,6 +16,7 @@
 #include <iostream>
 #include <unordered_map>
 #include <memory>
+#include <type_traits>
 
 
 using json = nlohmann::basic_json<>;
@@ -29,55 +34,109 @@ using std::string;
 using std::priority_queue;
 
 using cv::Point2f;
+typedef cv::Matx<float, 2, 3> Matx23;
 typedef cv::Matx<float, 3, 3> Matx33;
 typedef cv::Matx<float, 4, 1> Matx41;
 typedef cv::Matx<float, 4, 4> Matx44;
 
 
+//  Drawing surface: maps model space to an image and forwards each polygon to its render sinks
+//  The display list is retained while a sink needs it at save time, or setRetained() asks for it so the
+//  drawing can be replayed. By default a canvas rasterizes and writes SVG.
 class qcanvas
 {
     Matx33          m_globalTransform;
     cv::Mat         m_image;
-    svg::Document   m_svgDocument;
+    qdisplayList    m_displayList;
+    bool            m_retain = false;
+    bool            m_retaining = false;    // m_retain, or a sink needs the display list
+    std::vector<std::shared_ptr<qrenderSink> > m_sinks;
 
 public:
 
     qcanvas() {
+        addSink(std::make_shared<qrasterSink>());
+        addSink(std::make_shared<qsvgSink>());
     }
 
     cv::Mat const & getImage() const { return m_image; }
 
-    svg::Document const & getSVG() const { return m_svgDocument; }
+    qdisplayList const & getDisplayList() const { return m_displayList; }
 
+    Matx33 const & getGlobalTransform() const { return m_globalTransform; }
+
+    //  Sets the render target. The display list is kept, so replay() can redraw it at the new size.
     void create(cv::Mat im)
     {
         m_image = im;
 
-        // Match SVG dimensions to pixel size
-        m_svgDocument = svg::Document(svg::Layout(svg::Dimensions(im.cols, im.rows), svg::Layout::Origin::TopLeft)); // no flip, no scale
+        for (auto &sink : m_sinks)
+            sink->create(im);
     }
 
+    //  Clears the display list and starts a new drawing on every sink
     void clear()
     {
-        // clear image to black
-        m_image = 0;
+        m_displayList.clear();
+
+        for (auto &sink : m_sinks)
+            sink->clear();
+    }
 
-        // clear vector data
-        m_svgDocument = svg::Document(svg::Layout(svg::Dimensions(m_image.cols, m_image.rows), svg::Layout::Origin::TopLeft)); // no flip, no scale
+#pragma region Render sinks
 
-        // draw image border
-        svg::Polygon border(svg::Stroke(1, svg::Color(55, 55, 55)));
-        border << svg::Point(0, 0) << svg::Point(m_image.cols, 0)
-            << svg::Point(m_image.cols, m_image.rows) << svg::Point(0, m_image.rows);
-        m_svgDocument << border;
+    std::vector<std::shared_ptr<qrenderSink> > const & getSinks() const { return m_sinks; }
 
-        m_svgDocument << svg::Text(svg::Point(5, m_image.rows - 5), "Simple SVG", svg::Color(55, 55, 55), svg::Font(10, "Franklin Gothic"));
+    //  Attaches {sink}, starting a new drawing on it
+    void addSink(std::shared_ptr<qrenderSink> sink)
+    {
+        sink->create(m_image);
+        sink->clear();
+        m_sinks.push_back(sink);
+        updateRetaining();
     }
 
+    void clearSinks()
+    {
+        m_sinks.clear();
+        updateRetaining();
+    }
+
+    //  Replaces the sinks with those named; see qrenderSink::createFromName
+    void setSinks(std::vector<std::string> const &names, fs::path const &logPath = fs::path())
+    {
+        clearSinks();
+        for (auto const &name : names)
+            addSink(qrenderSink::createFromName(name, logPath));
+    }
+
+    //  Keeps the display list for replay(), even if no sink needs it
+    void setRetained(bool retain)
+    {
+        m_retain = retain;
+        updateRetaining();
+    }
+
+    bool isRetaining() const { return m_retaining; }
+
+    //  Whether fillPoly() does anything
+    bool isDrawing() const { return (m_retaining || !m_sinks.empty()); }
+
+    //  Writes each sink's output for {basePath}; false if any failed
+    bool save(fs::path const &basePath) const
+    {
+        bool saved = true;
+        for (auto &sink : m_sinks)
+            saved = sink->save(basePath, m_displayList, m_globalTransform) && saved;
+        return saved;
+    }
+
+#pragma endregion
+
     // sets global transform map to map provided domain to m_image, centered, vertically flipped
     void setTransformToFit(cv::Rect_<float> const &domain, float buffer)
     {
-        if (m_image.empty()) throw std::exception("Image is empty");
+        if (m_image.empty()) throw std::runtime_error("Image is empty");
 
         m_globalTransform = util::transform3x3::centerAndFit(
             domain, 
@@ -95,36 +154,64 @@ public:
 
     void fillPoly(std::vector<cv::Point2f> const &polygon, Matx33 const &transform, cv::Scalar color, int lineThickness, cv::Scalar lineColor)
     {
-        Matx33 m = m_globalTransform * transform;
+        if (!isDrawing())
+            return;
 
-        vector<cv::Point2f> v;
-        cv::transform(polygon, v, m.get_minor<2, 3>(0, 0));
-        vector<vector<cv::Point> > pts(1);
-        for (auto const& p : v)
-            pts[0].push_back(p * 16);
+        int index = (m_retaining ? m_displayList.add(polygon, transform, color) : m_displayList.addPolygon(polygon));
 
-        if (lineThickness > 0)
-        {
-            cv::fillPoly(m_image, pts, color, cv::LineTypes::LINE_8, 4);
-            cv::polylines(m_image, pts, true, lineColor, lineThickness, cv::LineTypes::LINE_AA, 4);
-        }
-        else
-        {
-            cv::fillPoly(m_image, pts, color, cv::LineTypes::LINE_AA, 4);
-        }
+        draw(index, polygon, transform, color, lineThickness, lineColor);
+    }
+
+    //  Lets sinks defer the following fillPoly() calls until endBatch(): the raster sink draws them by tile,
+    //  in parallel. Their line settings are taken from endBatch().
+    void beginBatch()
+    {
+        for (auto &sink : m_sinks)
+            sink->beginBatch();
+    }
 
+    void endBatch(int lineThickness, cv::Scalar lineColor)
+    {
+        for (auto &sink : m_sinks)
+            sink->endBatch(lineThickness, lineColor);
+    }
 
+    //  Redraws the display list from scratch on every sink, with the current image, transform and line settings
+    void replay(int lineThickness, cv::Scalar lineColor)
+    {
+        for (auto &sink : m_sinks)
+            sink->clear();
 
-        svg::Polygon svgPolygon(
-            svg::Fill(svg::Color((int)(0.5+color[2]), (int)(0.5+color[1]), (int)(0.5+color[0]))), 
-            svg::Stroke()   // no outline
-        );
-        for (auto const& p : v)
-            svgPolygon << svg::Point(p.x, p.y);
+        beginBatch();
 
-        m_svgDocument << svgPolygon;
+        auto const &polygons = m_displayList.getPolygons();
+        for (auto const &item : m_displayList.getItems())
+            draw(item.polygon, polygons[item.polygon], qdisplayList::getTransform(item), qdisplayList::getColor(item), lineThickness, lineColor);
 
+        endBatch(lineThickness, lineColor);
+    }
+
+private:
+    void updateRetaining()
+    {
+        m_retaining = m_retain || std::any_of(m_sinks.begin(), m_sinks.end(), [](auto const &sink) { return sink->needsDisplayList(); });
+        if (!m_retaining)
+            m_displayList.clear();
+    }
+
+    void draw(int index, std::vector<cv::Point2f> const &polygon, Matx33 const &transform, cv::Scalar color, int lineThickness, cv::Scalar lineColor)
+    {
+        if (m_sinks.empty())
+            return;
+
+        Matx23 m = (m_globalTransform * transform).get_minor<2, 3>(0, 0);
+
+        vector<cv::Point2f> v;
+        cv::transform(polygon, v, m);
 
+        qdrawCall call{ index, &polygon, m, &v, color, lineThickness, lineColor };
+        for (auto &sink : m_sinks)
+            sink->draw(call);
     }
 
 };
@@ -138,6 +225,10 @@ public:
     ColorTransform colorTransform;
     double gestation;
 
+    // cached index of transformMatrixKey in the owning qtree's key table; -1 until first use.
+    // Must be reset to -1 wherever transformMatrixKey is assigned.
+    mutable int keyId = -1;
+
 public:
 
     qtransform(Matx33 const &transformMatrix_ = Matx33::eye(), ColorTransform const &colorTransform_ = ColorTransform(), double gestation_ = 1.0)
@@ -200,6 +291,7 @@ inline void from_json(json const &j, qtransform &t)
     from_json(j.at("color"),     t.colorTransform);
     from_json(j.at("transform"), t.transformMatrix);
     t.transformMatrixKey = (j.contains("transformKey") ? j.at("transformKey") : "");
+    t.keyId = -1;
 }
 
 inline void to_json(json &j, std::vector<qtransform> const &transforms)
@@ -219,20 +311,25 @@ inline void from_json(json const &j, std::vector<qtransform> &transforms)
         if (transforms[i].transformMatrixKey.empty())
         {
             transforms[i].transformMatrixKey = string("T") + std::to_string(i);
+            transforms[i].keyId = -1;
         }
     }
 }
 
 
+//  Node record
+//  Nodes are copied in bulk through the queue and into node lists, so this is kept compact and trivially copyable:
+//  the source transform is an index into the tree's key table, the transform is a 2x3 affine,
+//  and the color is 4 floats.
 class qnode
 {
 public:
     int         id              = 0;
     int         parentId        = 0;
-    string      sourceTransform;
+    int         transformId     = -1;       // index into qtree::transformKeys; -1 for root nodes
     double      beginTime       = 0.0;
-    Matx33      globalTransform;
-    cv::Scalar  color = cv::Scalar(1.0, 0.5, 0.0, 1.0);
+    Matx23      globalTransform;
+    Matx41      color;
 
 
     qnode(int id_=0, int parentId_=0, double beginTime_ = 0)
@@ -240,19 +337,34 @@ public:
         id = id_;
         parentId = parentId_;
         beginTime = beginTime_;
-        color = cv::Scalar(1, 1, 1, 1);
-        globalTransform = globalTransform.eye();
+        color = Matx41(1, 1, 1, 1);
+        globalTransform = Matx23(1, 0, 0, 0, 1, 0);
+    }
+
+    inline cv::Scalar getColor() const { return cv::Scalar(color(0), color(1), color(2), color(3)); }
+
+    inline void setColor(cv::Scalar const &c) { color = Matx41((float)c[0], (float)c[1], (float)c[2], (float)c[3]); }
+
+    // full 3x3 form of globalTransform
+    inline Matx33 getTransform() const
+    {
+        auto const &m = globalTransform;
+        return Matx33(m(0, 0), m(0, 1), m(0, 2), m(1, 0), m(1, 1), m(1, 2), 0, 0, 1);
     }
 
+    inline void setTransform(Matx33 const &m) { globalTransform = m.get_minor<2, 3>(0, 0); }
+
     inline float det() const { return (globalTransform(0, 0) * globalTransform(1, 1) - globalTransform(0, 1) * globalTransform(1, 0)); }
 
     inline bool operator!() const { return !( fabs(det()) > 1e-5 ); }
 
+    //  Ties are broken by id, which is push order, so the order is total and every queue engine,
+    //  and serial and batch processing, pop nodes in the same order
     struct EarliestFirst
     {
-        bool operator()(qnode const& a, qnode const& b)
+        bool operator()(qnode const& a, qnode const& b) const
         {
-            return (a.beginTime > b.beginTime);
+            return (a.beginTime > b.beginTime || (a.beginTime == b.beginTime && a.id > b.id));
         }
     };
 
@@ -265,6 +377,62 @@ public:
     };
 };
 
+static_assert(std::is_trivially_copyable<qnode>::value, "qnode is copied in bulk through the queue");
+
+
+//  Lazily queued child
+//  In lazy mode the queue holds only the parent's slot in qtree::lazyParents, the child's id and the
+//  precomputed begin time. The child qnode is materialized when it reaches the front of the queue,
+//  so rejected children never pay for the transform product or color conversion.
+//  Ids are reserved when the children are pushed, as in eager mode, so a child keeps its id however
+//  often it is materialized, and the transform to apply is the child's offset from the parent's first child.
+struct qpending
+{
+    double      beginTime;
+    int         parentSlot;
+    int         id;
+
+    //  Ties are broken by id, which is push order, so every queue engine pops in the same order
+    struct EarliestFirst
+    {
+        bool operator()(qpending const& a, qpending const& b) const
+        {
+            return (a.beginTime > b.beginTime || (a.beginTime == b.beginTime && a.id > b.id));
+        }
+    };
+};
+
+static_assert(sizeof(qpending) == 16, "qpending should stay compact");
+
+
+//  Parent of lazily queued children, held in qtree::lazyParents until its last child is popped
+struct qlazyParent
+{
+    qnode       node;
+    int         firstChildId;
+    int         pendingChildren;
+};
+
+
+//  A node being evaluated for viability, with whatever the tree computed while testing it.
+//  Trees fill in the geometry they use in evaluate(), and reuse it in commit() instead of recomputing it.
+class qcandidate
+{
+public:
+    qnode                       node;
+    bool                        viable = false;
+
+    std::vector<cv::Point2f>    modelPoints;    // polygon in model coordinates
+    std::vector<cv::Point>      fieldPoints;    // polygon in field coordinates
+    int                         fieldLevel = 0; // field of fieldPoints: 0 base, 1 refined
+    cv::Rect                    fieldRect;      // bounding rect of fieldPoints
+    qbitmask                    fieldMask;      // collision mask covering fieldRect
+    uint64_t                    fieldVersion = 0;   // field version under fieldRect when tested
+
+    qcandidate() { }
+    explicit qcandidate(qnode const &node_) : node(node_) { }
+};
+
 
 //  This macro should be invoked for each qtree-extending class
 //  It creates a global function pointer (which is never used)
@@ -294,17 +462,32 @@ public:
     
     double gestationRandomness = 0.0;
 
+    // node queue settings
+    QueueEngine queueEngine = QueueEngine::HEAP;
+    double queueBucketWidth = 0.0;  // calendar bucket width; 0 derives it from the transforms' gestations
+    bool lazyChildren = false;      // queue (parent, transform) pairs rather than fully built children
+
     // draw settings
     cv::Scalar lineColor = cv::Scalar(0);
     int lineThickness = 0;
 
     // model
     std::mt19937 prng; //Standard mersenne_twister_engine with default seed
-    std::priority_queue<qnode, std::deque<qnode>, qnode::EarliestFirst> nodeQueue;
+    qqueue<qnode, qnode::EarliestFirst> nodeQueue;
     int nextNodeId = 1;
 
-    // stats
-    std::unordered_map<string, int> transformCounts;
+    // lazy mode: children waiting to be materialized, and the committed parents they refer to.
+    // A parent's slot is freed for reuse once all of its children have been popped.
+    qqueue<qpending, qpending::EarliestFirst> pendingQueue;
+    std::vector<qlazyParent> lazyParents;
+    std::vector<int> lazyFreeSlots;
+
+    // interned transform keys: qnode::transformId indexes into this table
+    std::vector<string> transformKeys;
+    std::unordered_map<string, int> transformKeyIds;
+
+    // stats: number of nodes added, indexed by qnode::transformId
+    std::vector<int> transformCounts;
 
 public:
     qtree() {}
@@ -317,6 +500,129 @@ public:
 
     virtual void randomizeTransforms(int flags) {};
 
+#pragma region Node queue
+
+    //  Empties the node queue, switching to the configured queue engine.
+    //  Extending classes should call this from create() before pushing the root node.
+    void resetQueue()
+    {
+        double bucketWidth = getQueueBucketWidth();
+        nodeQueue.setEngine(queueEngine, bucketWidth);
+        pendingQueue.setEngine(queueEngine, bucketWidth);
+        lazyParents.clear();
+        lazyFreeSlots.clear();
+        m_pendingTopValid = false;
+    }
+
+    //  Calendar bucket width: queueBucketWidth if set, otherwise derived from the gestations.
+    //  Queued nodes are due within the longest gestation of the front, so that window is spread
+    //  across the ring rather than piling the whole front into a few buckets.
+    double getQueueBucketWidth() const
+    {
+        if (queueBucketWidth > 0.0)
+            return queueBucketWidth;
+
+        double maxGestation = 0.0;
+        for (auto const &t : transforms)
+            maxGestation = std::max(maxGestation, t.gestation);
+
+        return getCalendarBucketWidth(maxGestation + std::max(gestationRandomness, 0.0));
+    }
+
+    bool isQueueEmpty() const { return nodeQueue.empty() && pendingQueue.empty(); }
+
+    size_t getQueueSize() const { return nodeQueue.size() + pendingQueue.size(); }
+
+    //  Returns the earliest queued node, materializing it first if it was queued lazily.
+    //  The queue must not be empty.
+    qnode const & peekNode();
+
+    //  Removes the node returned by peekNode()
+    void popNode();
+
+    //  Queues a child of {parent} for each transform
+    void pushChildren(qnode const & parent);
+
+    //  Lazy mode: materializes every queued child into the node queue, with the transform it was queued
+    //  with, keeping its id and place in the order. Must be called before transforms change mid-run,
+    //  since lazy children refer to transforms by index.
+    void flushLazyChildren();
+
+    //  Pops up to {maxNodes} of the earliest nodes that can be evaluated as a batch:
+    //  only nodes due before any child of the first could be, so committing them in order
+    //  leaves the queue exactly as serial processing would.
+    void popBatch(int maxNodes, std::vector<qnode> & batch);
+
+private:
+    // lazy mode: the materialized front of pendingQueue
+    qnode m_pendingTop;
+    bool m_pendingTopValid = false;
+
+    bool isPendingFirst() const
+    {
+        if (pendingQueue.empty())
+            return false;
+        if (nodeQueue.empty())
+            return true;
+
+        // same order as qnode::EarliestFirst
+        auto const &pending = pendingQueue.top();
+        auto const &node = nodeQueue.top();
+        return (pending.beginTime < node.beginTime || (pending.beginTime == node.beginTime && pending.id < node.id));
+    }
+
+public:
+
+#pragma endregion
+
+#pragma region Transform keys
+
+    //  Returns the ID for a transform key, adding it to the key table if necessary
+    int internTransformKey(string const &key)
+    {
+        auto it = transformKeyIds.find(key);
+        if (it != transformKeyIds.end())
+            return it->second;
+
+        int id = (int)transformKeys.size();
+        transformKeys.push_back(key);
+        transformKeyIds[key] = id;
+        return id;
+    }
+
+    //  Returns the ID for a transform's key, caching it on the transform.
+    //  Transforms without a key get -1, as root nodes do, so they are neither interned nor counted.
+    int getTransformId(qtransform const &t)
+    {
+        if (t.transformMatrixKey.empty())
+            return -1;
+        if (t.keyId < 0)
+            t.keyId = internTransformKey(t.transformMatrixKey);
+        return t.keyId;
+    }
+
+    //  Returns the transform key for an ID; root nodes (ID -1) have an empty key
+    string const & getTransformKey(int transformId) const
+    {
+        static string const none;
+        if (transformId < 0 || transformId >= (int)transformKeys.size())
+            return none;
+        return transformKeys[transformId];
+    }
+
+    //  Returns the number of nodes added so far by transform {t}; 0 for transforms without a key
+    int getTransformCount(qtransform const &t) const
+    {
+        if (t.transformMatrixKey.empty())
+            return 0;
+        auto it = transformKeyIds.find(t.transformMatrixKey);
+        if (it == transformKeyIds.end() || it->second >= (int)transformCounts.size())
+            return 0;
+        return transformCounts[it->second];
+    }
+
+#pragma endregion
+
 #pragma region Serialization
 
     //  Extending classes should override and invoke the base member as necessary
@@ -347,6 +653,12 @@ public:
 
         j["gestationRandomness"] = gestationRandomness;
 
+        j["queue"] = json{
+            { "engine", (queueEngine == QueueEngine::CALENDAR ? "calendar" : "heap") },
+            { "bucketWidth", queueBucketWidth },
+            { "lazy", lazyChildren }
+        };
+
         j["drawSettings"] = json{
             { "lineColor", util::toRgbHexString(lineColor) },
             { "lineThickness", lineThickness }
@@ -395,6 +707,20 @@ public:
 
         gestationRandomness = (j.contains("gestationRandomness") ? j.at("gestationRandomness").get<double>() : 0.0);
 
+        queueEngine = QueueEngine::HEAP;
+        queueBucketWidth = 0.0;
+        lazyChildren = false;
+        if (j.contains("queue"))
+        {
+            auto const &jq = j.at("queue");
+            if (jq.contains("engine"))
+                queueEngine = (jq.at("engine") == string("calendar") ? QueueEngine::CALENDAR : QueueEngine::HEAP);
+            if (jq.contains("bucketWidth"))
+                queueBucketWidth = jq.at("bucketWidth").get<double>();
+            if (jq.contains("lazy"))
+                lazyChildren = jq.at("lazy").get<bool>();
+        }
+
         if (j.contains("drawSettings"))
         {
             lineColor = util::fromRgbHexString(j.at("drawSettings").at("lineColor").get<string>().c_str());
@@ -422,14 +748,14 @@ public:
 
         if (!j.contains("_class"))
         {
-            throw(std::exception("Invalid JSON or missing \"_class\" key."));
+            throw(std::runtime_error("Invalid JSON or missing \"_class\" key."));
         }
 
         string className = j["_class"];
         if (factory().find(className) == factory().end())
         {
             string msg = string("Class not registered: '") + className + "'";
-            throw(std::exception(msg.c_str()));
+            throw(std::runtime_error(msg));
         }
 
         auto pfn = factory().at(className);
@@ -462,18 +788,38 @@ public:
     // process the next node in the queue
     virtual bool process();
 
+    // process up to {maxNodes} nodes, with the same results as calling process() repeatedly.
+    // nodes added are appended to {committed}, if provided, and the number of nodes popped,
+    // added or not, is stored in {popped}. returns the number of nodes added.
+    virtual int processBatch(int maxNodes, std::vector<qnode> *committed = nullptr, int *popped = nullptr);
+
     // override to indicate that a child node should not be added
     virtual bool isViable(qnode const & node) const { return true; }
 
     // invoked when a viable node is pulled from the queue. override to update drawing, data structures, etc.
     virtual void addNode(qnode & node);
 
+    // tests a candidate for viability, filling in any geometry needed to commit it.
+    // must not modify the tree, so candidates can be evaluated concurrently.
+    virtual bool evaluate(qcandidate & candidate) const
+    {
+        candidate.viable = isViable(candidate.node);
+        return candidate.viable;
+    }
+
+    // adds a viable candidate to the tree and queues its children
+    virtual void commit(qcandidate & candidate)
+    {
+        addNode(candidate.node);
+        pushChildren(candidate.node);
+    }
+
     virtual void getNodesIntersecting(cv::Rect2f const &rect, std::vector<qnode> &nodes) const {}
 
     // convenience fn: get node's polygon in model coordinates
     virtual void getPolyPoints(qnode const &node, std::vector<cv::Point2f> &transformedPoints) const
     {
-        cv::transform(polygon, transformedPoints, node.globalTransform.get_minor<2, 3>(0, 0));
+        cv::transform(polygon, transformedPoints, node.globalTransform);
     }
 
     virtual int removeNode(int id) { return 0; }
@@ -481,6 +827,12 @@ public:
     // generate a child node from a parent
     virtual void beget(qnode const & parent, qtransform const & t, qnode & child);
 
+    // computes a child's begin time. consumes random numbers, so children must be timed in queue order
+    double getChildBeginTime(qnode const & parent, qtransform const & t);
+
+    // fills in a child's parent, transform and color, but not its id or begin time
+    virtual void materialize(qnode const & parent, qtransform const & t, qnode & child);
+
     // fills vector with transform IDs
     virtual void getLineage(qnode const & node, std::vector<string> & lineage) const { }
 
@@ -510,13 +862,18 @@ public:
 
     virtual void saveImage(fs::path imagePath, qcanvas const &canvas) { };
 
+    // writes {basePath}.png, .svg and .settings.json, plus any outputs added by saveImage()
+    void saveOutputs(fs::path const &basePath, qcanvas const &canvas);
+
     virtual void combineWith(qtree const &tree, double a)
     {
         if (polygon != tree.polygon)
         {
-            throw(std::exception("Different polygon"));
+            throw(std::runtime_error("Different polygon"));
         }
 
+        flushLazyChildren();
+
 		std::cout << "combineWith: " << transforms.size() << " t x " << tree.transforms.size() << " t\n";
 
 		auto unmatchedTransforms = transforms;
@@ -561,6 +918,10 @@ public:
 		cout << "After matching: " << newTransforms.size() << " transforms\n";
 		transforms = newTransforms;
 
+        // transforms copied from {tree} carry key IDs from its table
+        for (auto &t : transforms)
+            t.keyId = -1;
+
 		name = std::string("[") + name + "+" + tree.name + "," + std::to_string(a) + "]";
     }
 
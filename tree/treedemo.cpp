@@ -20,14 +20,14 @@ bool TreeDemo::isValid() const
 {
     std::lock_guard lock(m_mutex);
 
-    return (pTree != nullptr && m_currentRun.valid() && !m_currentRun._Is_ready());
+    return (pTree != nullptr && m_currentRun.valid() && m_currentRun.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
 }
 
 bool TreeDemo::isWorkerTaskRunning() const
 { 
     std::lock_guard lock(m_mutex);
 
-    return (m_currentRun.valid() && !m_currentRun._Is_ready());
+    return (m_currentRun.valid() && m_currentRun.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
 }
 
 void TreeDemo::endWorkerTask()
@@ -63,7 +63,7 @@ void TreeDemo::startWorkerTask()
 
     m_currentRun = std::async(std::launch::async, [&] {
 
-        while (!pTree->nodeQueue.empty())
+        while (!pTree->isQueueEmpty())
         {
             if (m_cancel)
                 return;
@@ -95,7 +95,7 @@ bool TreeDemo::beginStepMode()
     m_stepping = true;
     m_maxNodesProcessedPerFrame = 1;
 
-    if (pTree->nodeQueue.empty())
+    if (pTree->isQueueEmpty())
         restart();
     int nodesProcessed = processNodes();
 
@@ -110,7 +110,7 @@ bool TreeDemo::endStepMode()
     m_stepping = false;
     m_maxNodesProcessedPerFrame = 64;
 
-    if (pTree->nodeQueue.empty())
+    if (pTree->isQueueEmpty())
         restart();
 
     // is worker thread complete? if so, kick it off
@@ -135,26 +135,48 @@ void TreeDemo::sendProgressUpdate()
 int TreeDemo::processNodes()
 {
     int nodesProcessed = 0;
-    while (!pTree->nodeQueue.empty()
+
+    // batch mode: candidates are tested concurrently, with the same results as the serial loop below.
+    // the frame budget counts every candidate popped, since a rejection costs as much to test as an addition
+    int candidatesPopped = 0;
+    while (m_batchMode && !m_stepping
+        && !pTree->isQueueEmpty()
+        && candidatesPopped < m_maxNodesProcessedPerFrame
+        && (nodesProcessed < m_minNodesProcessedPerFrame || pTree->peekNode().beginTime <= m_modelTime)
+        )
+    {
+        std::vector<qnode> committed;
+        int popped = 0;
+        nodesProcessed += pTree->processBatch(m_maxNodesProcessedPerFrame - candidatesPopped, &committed, &popped);
+        candidatesPopped += popped;
+
+        for (auto const &node : committed)
+        {
+            pTree->drawNode(canvas, node);
+            m_modelTime = node.beginTime + 1.0;
+        }
+    }
+
+    while (!pTree->isQueueEmpty()
         && nodesProcessed < m_maxNodesProcessedPerFrame
+        && candidatesPopped < m_maxNodesProcessedPerFrame
         //&& pTree->nodeQueue.top().det() >= cutoff 
-        && (nodesProcessed < m_minNodesProcessedPerFrame || pTree->nodeQueue.top().beginTime <= m_modelTime)
+        && (nodesProcessed < m_minNodesProcessedPerFrame || pTree->peekNode().beginTime <= m_modelTime)
         )
     {
         //std::lock_guard lock(m_mutex);
 
-        auto currentNode = pTree->nodeQueue.top();
-        if (!pTree->isViable(currentNode))
-        {
-            pTree->nodeQueue.pop();
+        qcandidate candidate(pTree->peekNode());
+        pTree->popNode();
+
+        if (!pTree->evaluate(candidate))
             continue;
-        }
 
-        pTree->drawNode(canvas, currentNode);
+        pTree->drawNode(canvas, candidate.node);
 
         nodesProcessed++;
-        pTree->process();
-        m_modelTime = currentNode.beginTime + 1.0;
+        pTree->commit(candidate);
+        m_modelTime = candidate.node.beginTime + 1.0;
     }
 
     m_totalNodesProcessed += nodesProcessed;
@@ -172,6 +194,13 @@ void TreeDemo::restart(bool randomize)
     processCommands();
 }
 
+//  Redraws the current tree at the current render size and line settings, without regrowing it
+void TreeDemo::rerender()
+{
+    m_rerender = true;
+    processCommands();
+}
+
 void TreeDemo::processCommands()
 {
     //std::lock_guard lock(m_mutex);
@@ -205,6 +234,8 @@ void TreeDemo::processCommands()
         cout << "--- Starting run: " << pTree->name << ": " << pTree->transforms.size() << " transforms" << endl;
 
         canvas.create(cv::Mat3b(m_renderSize));
+        canvas.setSinks(m_renderSinks);
+        canvas.setRetained(true);   // for rerender()
         canvas.clear();
         canvas.setTransformToFit(pTree->getBoundingRect(), m_imagePadding);
 
@@ -214,8 +245,27 @@ void TreeDemo::processCommands()
 
         m_modelTime = 0;
         m_totalNodesProcessed = 0;
+        profile::reset();
 
         m_restart = false;
+        m_rerender = false;
+
+        sendProgressUpdate();
+    }
+    else if (m_rerender)
+    {
+        endWorkerTask();
+
+        auto t0 = std::chrono::steady_clock::now();
+
+        canvas.create(cv::Mat3b(m_renderSize));
+        canvas.setTransformToFit(pTree->getBoundingRect(), m_imagePadding);
+        canvas.replay(pTree->lineThickness, pTree->lineColor);
+
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - t0).count();
+        cout << "--- Redrew " << canvas.getDisplayList().size() << " nodes at " << m_renderSize.width << "x" << m_renderSize.height << " in " << seconds << "s\n";
+
+        m_rerender = false;
 
         sendProgressUpdate();
     }
@@ -231,6 +281,7 @@ void TreeDemo::processCommands()
 void TreeDemo::showCommands()
 {
     cout << "| 'q' quit, 's' save, 'o',PgUp,PgDn open, 'C',' ' restart, '.'/',' step/continue, 'r' randomize, 'c' color, 'l' line color, 'p' polygon,\n"
+        << "| 'm' batch processing on/off,\n"
         << "| domain adjustments: +/-/arrows/0/1/2, 't' transforms,\n"
         << "| breeding: ctrl-b swap, B stash, b breed, ESC to quit.\n";
 }
@@ -246,12 +297,17 @@ void TreeDemo::showReport(double debounceSeconds)
 
     m_lastReportTime = curTime;
     cout << std::setw(8) << curTime << ": " << m_totalNodesProcessed << " nodes processed (" << ((double)m_totalNodesProcessed) / curTime << "/s)" << endl;
+
+    if (profile::isEnabled())
+    {
+        profile::report(cout);
+    }
 }
 
 int TreeDemo::openSettingsFile(int idx)
 {
     char filename[50];
-    sprintf_s(filename, "tree%04d.settings.json", idx);
+    snprintf(filename, sizeof(filename), "tree%04d.settings.json", idx);
     return openSettingsFile(fs::path(filename));
 }
 
@@ -259,7 +315,7 @@ int TreeDemo::openSettingsFile(fs::path path)
 {
     //  If path indicates a PNG, look for the corresponding settings file
     auto x = path.extension().native();
-    if (path.extension().native().compare(fs::path(L".png").native()) == 0)
+    if (path.extension().native().compare(fs::path(".png").native()) == 0)
     {
         path.replace_extension("settings.json");
     }
@@ -316,7 +372,7 @@ int TreeDemo::findPreviousFile(int endIndex) const
     {
         //std::cout << p.path() << '\n';
         int idx;
-        if (sscanf_s(p.path().filename().string().c_str(), "tree%d.settings.json", &idx) == 1)
+        if (sscanf(p.path().filename().string().c_str(), "tree%d.settings.json", &idx) == 1)
         {
             if (idx > lastIdx && idx < endIndex)
                 lastIdx = idx;
@@ -334,7 +390,7 @@ int TreeDemo::findNextFile(int startIndex) const
     char filename[40];
     for (int i = startIndex+1; i < MAX; ++i)
     {
-        sprintf_s(filename, "tree%04d.settings.json", i);
+        snprintf(filename, sizeof(filename), "tree%04d.settings.json", i);
         if (fs::exists(filename))
         {
             return i;
@@ -421,9 +477,14 @@ bool TreeDemo::processKey(int key)
 
     switch (key)
     {
+    case 'm':           // batch (multithreaded) processing toggle
+        m_batchMode = !m_batchMode;
+        cout << "Batch processing " << (m_batchMode ? "on" : "off") << endl;
+        return true;
+
     case 'h':           // HD/preview toggle
         m_renderSize = (m_renderSize == m_renderSizePreview ? m_renderSizeHD : m_renderSizePreview);
-        restart();
+        rerender();
         return true;
 
     case 'C':
@@ -522,7 +583,7 @@ bool TreeDemo::processKey(int key)
         {
             pTree->lineThickness = 0;
         }
-        restart();
+        rerender();
         return true;
 
     case 'c':   // randomize colors
@@ -571,7 +632,7 @@ bool TreeDemo::processKey(int key)
         {
             auto const &t = pTree->transforms[i];
             cout << std::setw(2) << i
-                    << ":" << std::setw(5) << pTree->transformCounts[t.transformMatrixKey] 
+                    << ":" << std::setw(5) << pTree->getTransformCount(t) 
                     << " " << std::setw(4) << std::setprecision(3) << t.gestation
                     << "  " << t.transformMatrixKey 
                     << "  " << t.colorTransform.description() << endl;
@@ -585,7 +646,11 @@ bool TreeDemo::processKey(int key)
         cout << "Drop transform? ";
         if (cin >> idx)
         {
+            endWorkerTask();
+            pTree->flushLazyChildren();
             pTree->transforms.erase(pTree->transforms.begin() + idx);
+            if (!m_stepping)
+                startWorkerTask();
         }
         return true;
     }
@@ -593,10 +658,12 @@ bool TreeDemo::processKey(int key)
     case 20:    // Ctrl-T
     {
         // remove unexpressed genes
+        endWorkerTask();
+        pTree->flushLazyChildren();
         int count = (int)pTree->transforms.size();
         for (auto it = pTree->transforms.begin(); it != pTree->transforms.end(); )
         {
-            if (pTree->transformCounts[it->transformMatrixKey] == 0)
+            if (pTree->getTransformCount(*it) == 0)
             {
                 it = pTree->transforms.erase(it);
             }
@@ -606,6 +673,8 @@ bool TreeDemo::processKey(int key)
             }
         }
         cout << "=== " << (count - pTree->transforms.size()) << " transforms removed.\n";
+        if (!m_stepping)
+            startWorkerTask();
         return true;
     }
 
@@ -666,7 +735,10 @@ bool TreeDemo::processKey(int key)
             auto other = m_breeders.back();
             cout << "** Breeding current " << pTree->name << endl;
             cout << "** Breeding with " << other->name << endl;
+            endWorkerTask();
             pTree->combineWith(*other, 0.1);
+            if (!m_stepping)
+                startWorkerTask();
             cout << "** trees combined: "<<pTree->name<<" **\n";
             //restart = true;
         }
@@ -710,33 +782,17 @@ int TreeDemo::save()
     cout << "Saving m_image and settings: " << m_currentFileIndex << endl;
 
     char name[24];
-    sprintf_s(name, "tree%04d", m_currentFileIndex);
-
-    // Write raster image to PNG file
+    snprintf(name, sizeof(name), "tree%04d", m_currentFileIndex);
 
-    fs::path imagePath = std::string(name) + ".png";
-    cv::imwrite(imagePath.string(), canvas.getImage());
+    pTree->saveOutputs(name, canvas);
 
-    // Write vector image to SVG file
-
-    auto svgPath = imagePath.replace_extension("svg");
-    canvas.getSVG().save(svgPath.string());
-
-    if (pTree->name.empty())
+    if (profile::isEnabled())
     {
-        pTree->name = name;
+        std::ofstream profileFile(std::string(name) + ".profile.json");
+        profileFile << std::setw(4) << profile::toJson();
     }
 
-    // allow extending classes to customize the save
-    pTree->saveImage(imagePath, canvas);
-
-    // save the settings too
-    std::ofstream outfile(imagePath.replace_extension("settings.json"));
-    json j;
-    pTree->to_json(j);
-    outfile << std::setw(4) << j;
-
-    cout << "Image saved: " << imagePath << endl;
+    cout << "Image saved: " << name << ".png" << endl;
 
     return 0;
 }
@@ -41,6 +41,8 @@ private:
     int m_minNodesProcessedPerFrame = 1;
     int m_maxNodesProcessedPerFrame = 64;
     bool m_stepping = false;
+    bool m_batchMode = false;   // process nodes with qtree::processBatch
+    std::vector<std::string> m_renderSinks = { "raster", "svg" };   // canvas outputs; see qrenderSink::createFromName
 
     int m_presetIndex = 0;
     float m_imagePadding = 0.1f;
@@ -54,6 +56,7 @@ private:
 
     // commands
     bool m_restart = true;
+    bool m_rerender = false;    // redraw the canvas from its display list
     bool m_randomize = true;
     bool m_quit = false;
 
@@ -89,6 +92,7 @@ public:
     bool isStepping() const { return m_stepping; }
 
     void restart(bool randomize=false);
+    void rerender();
 
     int processNodes();
 
@@ -6,6 +6,8 @@
 #include <opencv2/core/affine.hpp>
 #include <vector>
 #include <string>
+#include <cstdio>
+#include <stdexcept>
 
 
 // Operators for OpenCV types
@@ -51,8 +53,8 @@ namespace util
         {
             cv::Mat_<_Tp> m = cv::Mat_<_Tp>::eye(3, 3);
             m(cv::Range(0, 2), cv::Range::all()) = cv::getRotationMatrix2D(center, angle, scale);
-            m.at<_Tp>(0, 2) += translateX;
-            m.at<_Tp>(1, 2) += translateY;
+            m.template at<_Tp>(0, 2) += translateX;
+            m.template at<_Tp>(1, 2) += translateY;
             return m;
         }
 
@@ -71,9 +73,9 @@ namespace util
             cv::Mat_<_Tp> m = cv::Mat_<_Tp>::eye(3, 3);
             m(cv::Range(0, 2), cv::Range::all()) = cv::getRotationMatrix2D(cv::Point_<_Tp>(1.0, 0.0), angle, scale);
 
-            m.at<_Tp>(1, 1) = -m.at<_Tp>(1, 1);
-            m.at<_Tp>(0, 2) = offX;
-            m.at<_Tp>(1, 2) = offY;
+            m.template at<_Tp>(1, 1) = -m.template at<_Tp>(1, 1);
+            m.template at<_Tp>(0, 2) = offX;
+            m.template at<_Tp>(1, 2) = offY;
             return m;
         }
 
@@ -219,7 +221,7 @@ namespace util
         }
 
         char str[8];
-        sprintf_s(str, "%02x%02x%02x",
+        snprintf(str, sizeof(str), "%02x%02x%02x",
             (uchar)(0.5 + bgr(2)),
             (uchar)(0.5 + bgr(1)),
             (uchar)(0.5 + bgr(0))
@@ -231,7 +233,7 @@ namespace util
     inline cv::Scalar fromRgbHexString(char const * rgbString)
     {
         uint32_t rgb;
-        sscanf_s(rgbString, "%x", &rgb);
+        sscanf(rgbString, "%x", &rgb);
         //temp patch
         if (rgb && ((rgb & 0x01010101) == rgb))
         {
@@ -415,7 +417,7 @@ void from_json(json const &j, cv::Scalar_<_Tp> &color)
 {
     if (j.is_array())
     {
-        throw(std::exception("todo"));
+        throw(std::runtime_error("todo"));
     }
     if (j.is_string())
     {
@@ -423,7 +425,7 @@ void from_json(json const &j, cv::Scalar_<_Tp> &color)
     }
     else
     {
-        throw(std::exception("not convertible to color"));
+        throw(std::runtime_error("not convertible to color"));
     }
 }
 
@@ -444,7 +446,7 @@ template<typename _Tp>
 void from_json(json const &j, std::vector<cv::Point_<_Tp> > &polygon)
 {
     if (!j.is_array())
-        throw(std::exception("Not JSON array type"));
+        throw(std::runtime_error("Not JSON array type"));
 
     polygon.clear();
     polygon.reserve(j.size());